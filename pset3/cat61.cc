@@ -1,16 +1,56 @@
 #include "io61.hh"
+#include <algorithm>
 
-// Usage: ./cat61 [-s SIZE] [-o OUTFILE] [FILE]
+// Usage: ./cat61 [-s SIZE] [-c] [-a] [-p] [-d] [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE one character at a time.
+//    With `-c`, copies with a single call to `io61_copy` instead.
+//    With `-a`, reads FILE ahead asynchronously (IO61_ASYNC).
+//    With `-p`, copies from the input's buffer directly into the
+//    output's buffer using `io61_peek` and `io61_reserve`.
+//    With `-d`, opens both files IO61_DIRECT, bypassing the page cache.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args(argc, argv, "s:o:i:");
+    io61_arguments args(argc, argv, "s:capdo:i:");
 
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    int direct = args.direct ? IO61_DIRECT : 0;
+    io61_file* inf = io61_open_check(args.input_file,
+                                     O_RDONLY | direct
+                                     | (args.async ? IO61_ASYNC : 0));
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | direct);
+
+    if (args.copy) {
+        io61_copy(outf, inf, args.input_size);
+        args.input_size = 0;
+    }
+
+    while (args.borrow && args.input_size > 0) {
+        const char* ibuf;
+        size_t ilen;
+        if (io61_peek(inf, &ibuf, &ilen) < 0 || ilen == 0) {
+            break;
+        }
+        ilen = std::min(ilen, args.input_size);
+        size_t pos = 0;
+        while (pos != ilen) {
+            char* obuf;
+            size_t olen;
+            if (io61_reserve(outf, &obuf, &olen) < 0) {
+                break;
+            }
+            olen = std::min(olen, ilen - pos);
+            memcpy(obuf, ibuf + pos, olen);
+            io61_commit(outf, olen);
+            pos += olen;
+        }
+        io61_consume(inf, pos);
+        args.input_size -= pos;
+        if (pos != ilen) {
+            break;
+        }
+    }
 
     while (args.input_size > 0) {
         int ch = io61_readc(inf);
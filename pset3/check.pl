@@ -18,7 +18,7 @@ use List::Util qw(shuffle);
 use Config;
 my($nkilled) = 0;
 my($nerror) = 0;
-my(@ratios, @runtimes, @basetimes, @alltests);
+my(@ratios, @runtimes, @basetimes, @alltests, %pattern_ratios);
 my(%fileinfo);
 my($NOSTDIO) = exists($ENV{"NOSTDIO"});
 my($NOYOURCODE) = exists($ENV{"NOYOURCODE"});
@@ -31,10 +31,12 @@ my($MAXTIME) = exists($ENV{"MAXTIME"}) ? $ENV{"MAXTIME"} + 0 : 20;
 $MAXTIME = 20 if $MAXTIME <= 0;
 my($MAKETRIALLOG) = exists($ENV{"MAKETRIALLOG"}) && $ENV{"MAKETRIALLOG"} ne "" && $ENV{"MAKETRIALLOG"} ne "0";
 sub first (@) { return $_[0]; }
-my($CHECKSUM) = first(grep {-x $_} ("/usr/bin/md5sum", "/sbin/md5",
-                                    "/bin/false"));
+my($CHECKSUM);                  # ./sum61 if it builds, else md5sum
 my($VERBOSE) = exists($ENV{"VERBOSE"});
 my($NOMAKE) = exists($ENV{"NOMAKE"}) && int($ENV{"NOMAKE"});
+my($BENCH) = 0;
+my(@BUILDS) = exists($ENV{"BUILDS"}) ? split(" ", $ENV{"BUILDS"}) : ();
+my(@benchtests, @benchrows, %program_options);
 eval { require "syscall.ph" };
 
 my($Red, $Redctx, $Green, $Cyan, $Off) = ("\x1b[01;31m", "\x1b[0;31m", "\x1b[01;32m", "\x1b[01;36m", "\x1b[0m");
@@ -52,21 +54,29 @@ sub decache ($) {
     }
 }
 
+sub maybe_make ($) {
+    my($command) = @_;
+    if (!$NOMAKE && $command =~ m<(?:^|[|&;]\s*)./(\S+)>) {
+        $verbose = defined($ENV{"V"}) && $ENV{"V"} && $ENV{"V"} ne "0";
+        if (system($verbose ? "make $1" : "make -s $1") != 0) {
+            print STDERR "${Red}ERROR: Cannot make $1${Off}\n";
+            exit 1;
+        }
+    }
+}
+
 sub makefile ($) {
+    # inputs come from gen61; each file's fourth fileinfo entry seeds it
     my($filename) = @_;
     my($size) = $fileinfo{$filename}->[2];
-    my($cmd) = $filename =~ /-rev/ ? "rev" : "cat";
-    my($src) = $filename =~ /\.bin$/ ? "/bin/sh" : "/usr/share/dict/words";
-    my($first_offset) = "";
-    if (defined($fileinfo{$filename}->[3]) && $fileinfo{$filename}->[3]) {
-        $first_offset = " | tail -c +" . $fileinfo{$filename}->[3];
-    }
+    my($seed) = $fileinfo{$filename}->[3] ? $fileinfo{$filename}->[3] : 0;
+    my($binary) = $filename =~ /\.bin$/ ? " -B" : "";
     if (!-r $filename || !defined(-s $filename) || -s $filename != $size) {
-        while (!defined(-s $filename) || -s $filename < $size) {
-            system("$cmd $src$first_offset >> $filename");
-            $first_offset = "";
+        maybe_make("./gen61");
+        if (system("./gen61 -s $size -r $seed$binary -o $filename") != 0) {
+            print STDERR "${Red}ERROR: Cannot create $filename${Off}\n";
+            exit 1;
         }
-        truncate($filename, $size);
     }
     $fileinfo{$filename} = [-M $filename, -C $filename, $size];
 }
@@ -83,12 +93,48 @@ sub verify_file ($) {
     return -s $filename;
 }
 
-sub file_md5sum ($) {
+sub file_checksum ($) {
+    # return the checksum of a file, computed by $CHECKSUM
+    if (!defined($CHECKSUM)) {
+        system("make -s sum61 >/dev/null 2>&1") if !$NOMAKE;
+        $CHECKSUM = first(grep {-x $_} ("./sum61", "/usr/bin/md5sum",
+                                        "/sbin/md5", "/bin/false"));
+    }
     my($x) = `$CHECKSUM $_[0]`;
     $x =~ s{\A(\S+).*\z}{$1}s;
     return $x;
 }
 
+sub file_same_blocks ($$$) {
+    # return "" if `outfile` holds `infile`'s `bs`-byte blocks in any
+    # order, or a description of the first difference
+    my($infile, $outfile, $bs) = @_;
+    my($in, $out, %count);
+    foreach my $f ([$infile, \$in], [$outfile, \$out]) {
+        open(my $fh, "<", $f->[0]) or return "cannot read " . $f->[0];
+        binmode $fh;
+        local $/;
+        ${$f->[1]} = <$fh>;
+        close($fh);
+    }
+    return sprintf("size %d, expected %d", length($out), length($in))
+        if length($out) != length($in);
+    for (my $p = 0; $p < length($in); $p += $bs) {
+        ++$count{substr($in, $p, $bs)};
+    }
+    # the short final block, if any, may appear anywhere
+    my($last) = length($in) % $bs ? substr($in, -(length($in) % $bs)) : "";
+    for (my $p = 0; $p < length($out); ) {
+        my($b) = substr($out, $p, $bs);
+        $b = $last if !$count{$b} && $last ne "" && $count{$last}
+            && substr($out, $p, length($last)) eq $last;
+        return "block at byte $p is not an input block" if !$count{$b};
+        --$count{$b};
+        $p += length($b);
+    }
+    return "";
+}
+
 sub run_sh61_pipe ($$;$) {
     my($text, $fd, $size) = @_;
     my($n, $buf) = (0, "");
@@ -140,7 +186,9 @@ sub run_sh61 ($;%) {
         exit(1);
     }
 
-    POSIX::setpgid($run61_pid, $run61_pid) or die("setpgid: $!\n");
+    # EACCES: the child already ran setpgid and exec
+    POSIX::setpgid($run61_pid, $run61_pid) or $! == POSIX::EACCES
+        or die("setpgid: $!\n");
 
     my($before) = Time::HiRes::time();
     my($died) = 0;
@@ -195,7 +243,7 @@ sub run_sh61 ($;%) {
         return $answer;
     }
 
-    $nb = POSIX::read(fileno(PR), $buf, 2000);
+    $nb = POSIX::read(fileno(PR), $buf, 8192);
     close(PR);
     $buf = $nb > 0 ? substr($buf, 0, $nb) : "";
 
@@ -221,11 +269,11 @@ sub run_sh61 ($;%) {
             } elsif (($VERBOSE || $MAKETRIALLOG || exists($ENV{"TRIALLOG"}))
                      && -f $fname
                      && (!exists($opt{"no_content_check"}) || !$opt{"no_content_check"})) {
-                push @sums, file_md5sum($fname);
+                push @sums, file_checksum($fname);
             }
         }
         $answer->{"outputsize"} = $len;
-        $answer->{"md5sum"} = join(" ", @sums) if @sums;
+        $answer->{"checksum"} = join(" ", @sums) if @sums;
     }
 
     my(@stderr);
@@ -271,17 +319,6 @@ sub read_triallog ($) {
     close(TRIALLOG);
 }
 
-sub maybe_make ($) {
-    my($command) = @_;
-    if (!$NOMAKE && $command =~ m<(?:^|[|&;]\s*)./(\S+)>) {
-        $verbose = defined($ENV{"V"}) && $ENV{"V"} && $ENV{"V"} ne "0";
-        if (system($verbose ? "make $1" : "make -s $1") != 0) {
-            print STDERR "${Red}ERROR: Cannot make $1${Off}\n";
-            exit 1;
-        }
-    }
-}
-
 my(@workq, %command_max_size, %command_trials);
 
 sub find_tests ($$$) {
@@ -312,6 +349,15 @@ sub enqueue ($$$%) {
             $insize += verify_file($1);
         }
     }
+    # in benchmark mode, run the test later, once per matrix cell
+    if ($BENCH) {
+        push @benchtests, {
+            "test_number" => $number, "desc" => $desc, "command" => $command,
+            "infiles" => \@infiles, "maxsize" => $expansion * $insize
+        };
+        return;
+    }
+
     my($outsuf) = ".txt";
     $outsuf = ".bin" if $command =~ m<out\.bin>;
     my($no_content_check) = exists($opt{"no_content_check"});
@@ -418,12 +464,12 @@ sub median_trial ($$$;$) {
         return $errortests[0];
     }
 
-    # collect stderr and md5sum from all tests
+    # collect stderr and checksums from all tests
     my($stderr) = join("", map {
                            exists($_->{"stderr"}) ? $_->{"stderr"} : ""
                        } @tests);
-    my(%md5sums) = map {
-        exists($_->{"md5sum"}) ? ($_->{"md5sum"} => 1) : ()
+    my(%checksums) = map {
+        exists($_->{"checksum"}) ? ($_->{"checksum"} => 1) : ()
     } @tests;
     my(%outputsizes) = map {
         exists($_->{"outputsize"}) ? ($_->{"outputsize"} => 1) : ()
@@ -452,10 +498,15 @@ sub median_trial ($$$;$) {
                     $tt->{"different_content"} = " ($r)" if $?;
                 }
             }
-            if (exists($tcompar->{"md5sum_check"}) && exists($tt->{"md5sum"})) {
-                $tt->{"different_content"} = " (got md5sum " . $tt->{"md5sum"}
-                    . ", expected " . $tcompar->{"md5sum_check"} . ")"
-                    if $tcompar->{"md5sum_check"} ne $tt->{"md5sum"};
+            if (exists($tcompar->{"block_check"})) {
+                my($infile, $outfile, $bs) = @{$tcompar->{"block_check"}};
+                my($r) = file_same_blocks($infile, $outfile, $bs);
+                $tt->{"different_content"} = " ($r)" if $r ne "";
+            }
+            if (exists($tcompar->{"checksum_check"}) && exists($tt->{"checksum"})) {
+                $tt->{"different_content"} = " (got checksum " . $tt->{"checksum"}
+                    . ", expected " . $tcompar->{"checksum_check"} . ")"
+                    if $tcompar->{"checksum_check"} ne $tt->{"checksum"};
             }
         }
 
@@ -468,10 +519,10 @@ sub median_trial ($$$;$) {
     # decorate it
     $tt->{"medianof"} = scalar(@tests);
     $tt->{"stderr"} = $stderr;
-    if (keys(%md5sums) == 1) {
-        $tt->{"md5sum"} = (keys(%md5sums))[0];
+    if (keys(%checksums) == 1) {
+        $tt->{"checksum"} = (keys(%checksums))[0];
     }
-    if (keys(%outputsizes) > 1 || keys(%md5sums) > 1) {
+    if (keys(%outputsizes) > 1 || keys(%checksums) > 1) {
         $tt->{"stderr"} .= "    ${Red}ERROR: trial runs generated different output${Off}\n";
     }
     return $tt;
@@ -490,6 +541,22 @@ sub print_stdio ($) {
     }
 }
 
+sub si_count ($) {
+    my($n) = @_;
+    return sprintf("%.1fG", $n / 1e9) if $n >= 1e9;
+    return sprintf("%.1fM", $n / 1e6) if $n >= 1e6;
+    return sprintf("%.1fK", $n / 1e3) if $n >= 1e4;
+    return sprintf("%d", $n);
+}
+
+sub si_nsec ($) {
+    my($ns) = @_;
+    return sprintf("%.1fs", $ns / 1e9) if $ns >= 1e9;
+    return sprintf("%.1fms", $ns / 1e6) if $ns >= 1e6;
+    return sprintf("%.1fus", $ns / 1e3) if $ns >= 1e3;
+    return sprintf("%dns", $ns);
+}
+
 sub run ($) {
     my($sequentially) = @_;
     my($number, $type) = (0, undef);
@@ -550,8 +617,15 @@ sub run ($) {
         if (!$NOYOURCODE && !$qitem->{"no_content_check"}) {
             $tcompar->{"content_check"} = $qitem->{"outfiles"}
                 if !$NOSTDIO && $sequentially;
-            $tcompar->{"md5sum_check"} = $stdiot->{"md5sum"}
-                if $NOSTDIO && $stdiot && exists($stdiot->{"md5sum"});
+            $tcompar->{"checksum_check"} = $stdiot->{"checksum"}
+                if $NOSTDIO && $stdiot && exists($stdiot->{"checksum"});
+        }
+        if (!$NOYOURCODE && $sequentially
+            && exists($qitem->{"opt"}->{"block_check"})) {
+            # output blocks arrive in any order
+            $tcompar->{"block_check"} = [$qitem->{"infiles"}->[0],
+                                         $qitem->{"outfiles"}->[0],
+                                         $qitem->{"opt"}->{"block_check"}];
         }
 
         my($tt) = median_trial($number, "yourcode", $qitem, $tcompar);
@@ -572,9 +646,52 @@ sub run ($) {
             && !exists($tt->{"different_content"})) {
             my($ratio) = $stdiot->{"time"} / $tt->{"time"};
             my($color) = ($ratio < 0.5 ? $Redctx : ($ratio > 1.9 ? $Green : $Cyan));
-            printf("RATIO:     ${color}%.2fx stdio${Off}\n", $ratio);
+            printf("RATIO:     ${color}%.2fx stdio${Off}", $ratio);
+            # system calls per MB of output, if the io61 library counts them
+            my($ncalls) = 0;
+            foreach my $k ("read_calls", "write_calls", "seek_calls", "mmap_calls") {
+                $ncalls += $tt->{$k} if exists($tt->{$k});
+            }
+            if ($ncalls && $tt->{"outputsize"}) {
+                printf(" (%.1f syscalls/MB)", $ncalls * 1048576 / $tt->{"outputsize"});
+            }
+            # throughput and page cache footprint of IO61_DIRECT files
+            if ($tt->{"direct_files"} && $tt->{"outputsize"}) {
+                printf(" (%.1f MB/s, %dKiB cached)",
+                       $tt->{"outputsize"} / 1048576 / $tt->{"time"},
+                       $tt->{"cached_bytes"} / 1024);
+            }
+            # throughput and compression ratio of lz61 streams
+            if ($tt->{"zplain_bytes"}) {
+                printf(" (%.1f MB/s, packed to %.1f%%)",
+                       $tt->{"zplain_bytes"} / 1048576 / $tt->{"time"},
+                       100 * $tt->{"zpacked_bytes"} / $tt->{"zplain_bytes"});
+            }
+            print "\n";
+            # hardware and software event counts, if the kernel provides them
+            my(@counters) = grep { exists($tt->{$_}) }
+                ("cycles", "instructions", "llc_misses", "page_faults", "context_switches");
+            if (@counters) {
+                print "COUNTERS:  ", join(", ", map {
+                    my($name) = $_;
+                    $name =~ tr/_/ /;
+                    si_count($tt->{$_}) . " $name"
+                        . (exists($stdiot->{$_}) ? " (stdio " . si_count($stdiot->{$_}) . ")" : "")
+                } @counters), "\n";
+            }
+            # latency percentiles, with IO61_LATENCY=1
+            foreach my $op ("read", "write", "seek", "flush", "miss",
+                            "sysread", "syswrite") {
+                next if !$tt->{"lat_${op}_n"};
+                printf("LATENCY:   %-8s %s calls, p50 %s, p99 %s, p99.9 %s, max %s\n",
+                       $op, si_count($tt->{"lat_${op}_n"}),
+                       map { si_nsec($tt->{"lat_${op}_$_"}) } ("p50", "p99", "p999", "max"));
+            }
             push @ratios, $ratio;
             push @basetimes, $stdiot->{"time"};
+            # access pattern is the last clause of the description
+            my($pattern) = $qitem->{"desc"} =~ m{,\s*([^,]*?)\s*$};
+            push @{$pattern_ratios{$pattern}}, $ratio if defined($pattern);
         }
         if (exists($tt->{"different_size"})) {
             print "    ${Red}ERROR: ", join("+", @{$qitem->{"outfiles"}}), " has size ", $tt->{"outputsize"}, ", expected ", $stdiot->{"outputsize"}, "${Off}\n";
@@ -629,6 +746,13 @@ sub summary () {
         printf "           average %.2fx stdio\n", $mean / @ratios;
         printf "           total time %.3fs stdio, %.3fs your code (%.2fx stdio)\n",
         $basetime, $runtime, $basetime / $runtime;
+        foreach my $pattern (sort keys %pattern_ratios) {
+            my($pr) = $pattern_ratios{$pattern};
+            my($psum) = 0;
+            $psum += $_ foreach @$pr;
+            printf "           %s: average %.2fx stdio (%s)\n",
+            $pattern, $psum / @$pr, pl(scalar(@$pr), "test");
+        }
     } elsif (@runtimes) {
         printf "           total time %.3f your code\n", $runtime;
     }
@@ -651,6 +775,277 @@ sub summary () {
     }
 }
 
+# BENCHMARK MODE
+#    `check.pl -m [TESTS]` runs each test once per cell of a parameter
+#    matrix and reports median times with 95% confidence intervals.
+#    MATRIX lists the dimensions, such as "b=512,4096 t=2,1048576
+#    cache=cold,warm". A one-letter key sets that option on every program
+#    in the command that takes it, according to its usage message;
+#    `cache=warm` leaves the inputs in the page cache. BUILDS lists
+#    directories holding other builds (see `make baseline`), which run
+#    interleaved with ./ and are compared with it: a cell is flagged if
+#    the medians differ by more than 5% and a Mann-Whitney test gives
+#    p < 0.05. BENCHOUT names a .csv or .json file for the results.
+
+sub median (@) {
+    my(@x) = sort { $a <=> $b } @_;
+    return @x % 2 ? $x[$#x / 2] : ($x[@x / 2 - 1] + $x[@x / 2]) / 2;
+}
+
+sub median_interval (@) {
+    # distribution-free: the order statistics ranked n/2 +- 0.98 sqrt(n)
+    my(@x) = sort { $a <=> $b } @_;
+    my($k) = int((@x - 1.96 * sqrt(scalar(@x))) / 2);
+    $k = 0 if $k < 0;
+    return ($x[$k], $x[$#x - $k]);
+}
+
+sub mann_whitney ($$) {
+    # two-sided p-value, normal approximation with continuity correction
+    my($x, $y) = @_;
+    return 1 if !@$x || !@$y;
+    my(@all) = sort { $a->[0] <=> $b->[0] } ((map { [$_, 1] } @$x),
+                                             (map { [$_, 0] } @$y));
+    my($rx) = 0;
+    for (my $i = 0; $i < @all; ) {
+        my($j) = $i;
+        ++$j while $j + 1 < @all && $all[$j + 1]->[0] == $all[$i]->[0];
+        foreach my $k ($i .. $j) {
+            $rx += ($i + $j) / 2 + 1 if $all[$k]->[1];
+        }
+        $i = $j + 1;
+    }
+    my($nx, $ny) = (scalar(@$x), scalar(@$y));
+    my($u) = $rx - $nx * ($nx + 1) / 2;
+    my($z) = (abs($u - $nx * $ny / 2) - 0.5)
+        / sqrt($nx * $ny * ($nx + $ny + 1) / 12);
+    return $z > 0 ? POSIX::erfc($z / sqrt(2)) : 1;
+}
+
+sub program_options ($) {
+    # options that take an argument, except input and output files
+    my($prog) = @_;
+    if (!exists($program_options{$prog})) {
+        maybe_make("./$prog");
+        my($usage) = scalar(`./$prog '-?' 2>&1`);
+        $program_options{$prog} = join("", grep { $_ ne "o" && $_ ne "i" }
+                                       $usage =~ m{\[-(\w) [A-Z]+\]}g);
+    }
+    return $program_options{$prog};
+}
+
+sub bench_matrix () {
+    my(@cells) = ({});
+    foreach my $dim (split(" ", exists($ENV{"MATRIX"}) ? $ENV{"MATRIX"} : "")) {
+        my($k, $vs) = $dim =~ m{\A(\w+)=(\S+)\z};
+        if (!defined($k) || ($k ne "cache" && $k !~ m{\A[a-hj-np-z]\z})
+            || ($k eq "cache" && $vs !~ m{\A(?:cold|warm)(?:,(?:cold|warm))*\z})) {
+            print STDERR "${Red}ERROR: bad MATRIX dimension '$dim'${Off}\n";
+            exit 1;
+        }
+        @cells = map { my($c) = $_; map { +{%$c, $k => $_} } split(/,/, $vs) } @cells;
+    }
+    return @cells;
+}
+
+sub bench_command ($$) {
+    # apply a cell's options to a command; return it and the options used
+    my($command, $cell) = @_;
+    my(%used) = ("cache" => exists($cell->{"cache"}) ? $cell->{"cache"} : "cold");
+    $command =~ s{(\./([a-z]*61))([^|<>]*)}{
+        my($path, $prog, $args) = ($1, $2, $3);
+        foreach my $k (sort(grep { length($_) == 1 } keys %$cell)) {
+            if ($args =~ s{(\s-$k\s+)\S+}{$1$cell->{$k}}) {
+                $used{$k} = $cell->{$k};
+            } elsif (index(program_options($prog), $k) >= 0) {
+                $args = " -$k $cell->{$k}" . $args;
+                $used{$k} = $cell->{$k};
+            }
+        }
+        $path . $args;
+    }ge;
+    return ($command, join(" ", map { "$_=$used{$_}" } sort keys %used));
+}
+
+sub bench_cell ($$$) {
+    my($bt, $command, $label) = @_;
+    my($number) = $bt->{"test_number"};
+    print "TEST:      $number. ", $bt->{"desc"}, "\n";
+    print "CELL:      $label\n";
+    print "COMMAND:   $command\n" if !exists($ENV{"NOCOMMAND"});
+    maybe_make($command);
+
+    # one run per build, plus stdio
+    my(@runs) = ({"build" => "yourcode", "label" => "YOUR CODE:",
+                  "command" => $command, "time_limit" => $MAXTIME});
+    foreach my $dir (@BUILDS) {
+        my($c) = $command;
+        $c =~ s<\./([a-z]*61)><$dir/$1>g;
+        my(@missing) = grep { !-x "$dir/$_" } $command =~ m<\./([a-z]*61)>g;
+        if (@missing) {
+            print "${Redctx}$dir: no $missing[0], skipping${Off}\n";
+            next;
+        }
+        push @runs, {"build" => $dir, "label" => "$dir:",
+                     "command" => $c, "time_limit" => $MAXTIME};
+    }
+    if (!$NOSTDIO) {
+        my($c) = $command;
+        $c =~ s<(\./)([a-z]*61)><${1}stdio-$2>g;
+        $c =~ s<out(\d*)\.(txt|bin)><baseout$1\.$2>g;
+        push @runs, {"build" => "stdio", "label" => "STDIO:",
+                     "command" => $c, "time_limit" => 60};
+    }
+    foreach my $r (@runs) {
+        my(@outfiles) = $r->{"command"} =~ m{([^\s<>]*out\d*\.(?:txt|bin))}g;
+        $r->{"outfiles"} = \@outfiles;
+        $r->{"trials"} = [];
+        $r->{"errors"} = 0;
+    }
+
+    # interleave the builds' trials, so they see the same conditions
+    my($warm) = $label =~ m{cache=warm};
+    system("cat " . join(" ", @{$bt->{"infiles"}}) . " > /dev/null")
+        if $warm && @{$bt->{"infiles"}};
+    for (my $i = 0; $i < $TRIALS; ++$i) {
+        foreach my $r (shuffle(@runs)) {
+            next if $r->{"errors"} > 1;
+            if (!$warm) {
+                decache($_) foreach @{$bt->{"infiles"}};
+            }
+            Time::HiRes::usleep(100000);
+            my($t) = run_sh61($r->{"command"},
+                              "size_limit_file" => $r->{"outfiles"},
+                              "time_limit" => $r->{"time_limit"},
+                              "size_limit" => $bt->{"maxsize"} ? 2 * $bt->{"maxsize"} : undef,
+                              "answer" => {"number" => $number,
+                                           "type" => $r->{"build"},
+                                           "trial" => $i + 1},
+                              "no_content_check" => 1);
+            push @alltests, $t;
+            if (exists($t->{"killed"})) {
+                $r->{"errors"} += 1;
+                print $t->{"stderr"} if exists($t->{"stderr"});
+            } else {
+                push @{$r->{"trials"}}, $t;
+            }
+        }
+    }
+
+    # report each build, comparing it with your code
+    my($mine) = $runs[0];
+    my(@mytimes) = map { $_->{"time"} } @{$mine->{"trials"}};
+    foreach my $r (@runs) {
+        my(@times) = map { $_->{"time"} } @{$r->{"trials"}};
+        my($row) = {
+            "test" => $number, "desc" => $bt->{"desc"}, "cell" => $label,
+            "build" => $r->{"build"}, "command" => $r->{"command"},
+            "trials" => scalar(@times), "killed" => $r->{"errors"},
+            "times" => \@times
+        };
+        push @benchrows, $row;
+        printf("%-10s ", $r->{"label"});
+        if (!@times) {
+            printf("${Red}KILLED${Off}\n");
+            next;
+        }
+        $row->{"median"} = median(@times);
+        ($row->{"ci_low"}, $row->{"ci_high"}) = median_interval(@times);
+        foreach my $k ("utime", "stime", "maxrss", "cycles", "instructions",
+                       "llc_misses", "page_faults", "context_switches") {
+            my(@vs) = map { exists($_->{$k}) ? ($_->{$k}) : () } @{$r->{"trials"}};
+            $row->{$k} = median(@vs) if @vs;
+        }
+        printf("%.5fs median, 95%% CI [%.5fs, %.5fs] (%s%s)\n",
+               $row->{"median"}, $row->{"ci_low"}, $row->{"ci_high"},
+               pl(scalar(@times), "trial"),
+               $r->{"errors"} ? ", " . $r->{"errors"} . " killed" : "");
+        next if $r == $mine || !@mytimes;
+
+        $row->{"ratio"} = $row->{"median"} / median(@mytimes);
+        $row->{"p"} = mann_whitney(\@times, \@mytimes);
+        my($verdict) = "";
+        if ($r->{"build"} ne "stdio" && $row->{"p"} < 0.05) {
+            $verdict = "regression" if $row->{"ratio"} < 1 / 1.05;
+            $verdict = "improvement" if $row->{"ratio"} > 1.05;
+        }
+        $row->{"verdict"} = $verdict;
+        my($color) = $verdict eq "regression" ? $Red
+            : ($verdict eq "improvement" ? $Green : $Cyan);
+        printf("RATIO:     ${color}%.2fx %s (p=%.3f)%s${Off}\n",
+               $row->{"ratio"}, $r->{"build"}, $row->{"p"},
+               $verdict ? " " . uc($verdict) : "");
+    }
+    print "\n";
+}
+
+sub bench () {
+    foreach my $dir (@BUILDS) {
+        if (!-d $dir) {
+            print STDERR "${Red}ERROR: no build in '$dir' (try 'make baseline')${Off}\n";
+            exit 1;
+        }
+    }
+    my(@cells) = bench_matrix();
+    foreach my $bt (@benchtests) {
+        my(%seen);
+        foreach my $cell (@cells) {
+            my($command, $label) = bench_command($bt->{"command"}, $cell);
+            bench_cell($bt, $command, $label) if !$seen{$label}++;
+        }
+    }
+}
+
+sub bench_field ($) {
+    my($v) = @_;
+    return "" if !defined($v);
+    return $v if looks_like_number($v);
+    $v =~ s/"/""/g;
+    return "\"$v\"";
+}
+
+sub bench_summary () {
+    my(@compared) = grep { exists($_->{"verdict"}) && $_->{"build"} ne "stdio" } @benchrows;
+    my(@regressions) = grep { $_->{"verdict"} eq "regression" } @compared;
+    my(@improvements) = grep { $_->{"verdict"} eq "improvement" } @compared;
+    print "SUMMARY:   ", pl(scalar(grep { $_->{"build"} eq "yourcode" } @benchrows), "cell");
+    if (@compared) {
+        print ", ", pl(scalar(@compared), "build comparison"), ", ",
+            (@regressions ? $Red : ""), pl(scalar(@regressions), "regression"),
+            (@regressions ? $Off : ""), ", ", pl(scalar(@improvements), "improvement");
+    }
+    print "\n";
+    foreach my $row (@regressions, @improvements) {
+        printf("           %s: test %d [%s], %.2fx %s (p=%.3f)\n",
+               $row->{"verdict"}, $row->{"test"}, $row->{"cell"},
+               $row->{"ratio"}, $row->{"build"}, $row->{"p"});
+    }
+
+    return if !exists($ENV{"BENCHOUT"}) || $ENV{"BENCHOUT"} eq "";
+    my(@keys) = ("test", "desc", "cell", "build", "command", "trials",
+                 "killed", "median", "ci_low", "ci_high", "utime", "stime",
+                 "maxrss", "cycles", "instructions", "llc_misses",
+                 "page_faults", "context_switches", "ratio", "p", "verdict");
+    open(BENCHOUT, ">", $ENV{"BENCHOUT"}) or die "$ENV{BENCHOUT}: $!\n";
+    if ($ENV{"BENCHOUT"} =~ m{\.json\z}) {
+        my(@rowjsons);
+        foreach my $row (@benchrows) {
+            my(@rout) = map {
+                "\"$_\":" . (looks_like_number($row->{$_}) ? $row->{$_} : "\"$row->{$_}\"")
+            } grep { defined($row->{$_}) } @keys;
+            push @rout, "\"times\":[" . join(",", @{$row->{"times"}}) . "]";
+            push @rowjsons, "{" . join(",", @rout) . "}";
+        }
+        print BENCHOUT "[", join(",\n ", @rowjsons), "]\n";
+    } else {
+        print BENCHOUT join(",", @keys), "\n";
+        foreach my $row (@benchrows) {
+            print BENCHOUT join(",", map { bench_field($row->{$_}) } @keys), "\n";
+        }
+    }
+    close(BENCHOUT);
+}
+
 # maybe read a trial log
 if (exists($ENV{"TRIALLOG"})) {
     read_triallog($ENV{"TRIALLOG"});
@@ -667,10 +1062,11 @@ $fileinfo{"files/text90k-rev.txt"} = [0, 0, 90 << 10, 2 << 10];
 $fileinfo{"files/binary1meg.bin"} = [0, 0, 1 << 20, 3 << 10];
 $fileinfo{"files/text5meg.txt"} = [0, 0, 5 << 20, 4 << 10];
 $fileinfo{"files/text20meg.txt"} = [0, 0, 20 << 20, 5 << 10];
+$fileinfo{"files/text8k.txt"} = [0, 0, 8 << 10, 6 << 10];
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
-    summary();
+    $BENCH ? bench_summary() : summary();
     exit(1);
 };
 
@@ -680,6 +1076,8 @@ while (@ARGV) {
         $sequentially = 0;
     } elsif ($ARGV[0] eq "-V") {
         $VERBOSE = 1;
+    } elsif ($ARGV[0] eq "-m") {
+        $BENCH = 1;
     } else {
         last;
     }
@@ -830,6 +1228,259 @@ enqueue(31,
     "redirected large file, 1B-4KB block I/O, sequential");
 
 
-run($sequentially);
 
-summary();
+# ZERO-COPY TRANSFERS
+
+enqueue(32,
+    "./cat61 -c -o files/out.txt files/text20meg.txt",
+    "regular large file, io61_copy, sequential");
+
+enqueue(33,
+    "cat files/text20meg.txt | ./cat61 -c | cat > files/out.txt",
+    "piped large file, io61_copy, sequential");
+
+
+
+# SMALL SCATTERED WRITES (each step moves 64 bytes through io61_readv
+# and io61_writev, one byte per buffer)
+
+enqueue(34,
+    "./scattergather61 -b 1 -v 64 -o files/out1.txt -o files/out2.txt -o files/out3.txt -o files/out4.txt -o files/out5.txt -o files/out6.txt < files/text1meg.txt",
+    "scattered small file to 6 files, 64-buffer vectored character I/O, sequential");
+
+
+
+# ASYNCHRONOUS READ-AHEAD (inputs are decached before every trial)
+
+enqueue(35,
+    "./cat61 -a -o files/out.txt files/text20meg.txt",
+    "regular large file, async read-ahead, sequential");
+
+enqueue(36,
+    "cat files/text20meg.txt | ./cat61 -a | cat > files/out.txt",
+    "piped large file, async read-ahead, sequential");
+
+
+
+# OUT-OF-ORDER WRITES
+
+enqueue(37,
+    "./reordercat61 -b 1 -o files/out.txt files/text1meg.txt",
+    "regular small file, character I/O, random seek order");
+
+enqueue(38,
+    "./reordercat61 -b 512 -o files/out.txt files/text20meg.txt",
+    "regular large file, 512B block I/O, random seek order");
+
+enqueue(39,
+    "./reordercat61 -b 4096 -r 6582 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 4KB block I/O, random seek order");
+
+
+
+# LINE-ORIENTED I/O
+
+enqueue(40,
+    "./scattergather61 -b 4096 -l -o files/out1.txt -o files/out2.txt -o files/out3.txt -i files/text20meg.txt",
+    "regular large file to 3 files, line I/O, sequential");
+
+
+
+# BORROWED BUFFERS
+
+enqueue(41,
+    "./cat61 -p -o files/out.txt files/text20meg.txt",
+    "regular large file, io61_peek, sequential");
+
+enqueue(42,
+    "cat files/text20meg.txt | ./cat61 -p | cat > files/out.txt",
+    "piped large file, io61_peek, sequential");
+
+
+
+# BLOCK SIZE SWEEP
+
+enqueue(43,
+    "./blockcat61 -b 1 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 1B block I/O, sequential");
+
+enqueue(44,
+    "./blockcat61 -b 65536 -o files/out.txt files/text20meg.txt",
+    "regular large file, 64KB block I/O, sequential");
+
+enqueue(45,
+    "./blockcat61 -b 1048576 -o files/out.txt files/text20meg.txt",
+    "regular large file, 1MB block I/O, sequential");
+
+enqueue(46,
+    "cat files/text20meg.txt | ./blockcat61 -b 65536 | cat > files/out.txt",
+    "piped large file, 64KB block I/O, sequential");
+
+enqueue(47,
+    "cat files/text20meg.txt | ./blockcat61 -b 1048576 | cat > files/out.txt",
+    "piped large file, 1MB block I/O, sequential");
+
+
+
+# MULTITHREADED I/O (output blocks arrive in any order)
+
+enqueue(48,
+    "./mtblockcat61 -b 512 -j 4 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4 threads, 512B block I/O, shared output",
+    "no_content_check" => 1, "block_check" => 512);
+
+enqueue(49,
+    "./mtblockcat61 -b 65536 -j 8 -o files/out.txt files/text20meg.txt",
+    "regular large file, 8 threads, 64KB block I/O, shared output",
+    "no_content_check" => 1, "block_check" => 65536);
+
+
+
+# PARALLEL FAN-IN/FAN-OUT (compare parcat61 with serial scattergather61)
+
+enqueue(50,
+    "./scattergather61 -b 4096 -o files/out1.txt -o files/out2.txt -o files/out3.txt -i files/text20meg.txt -i files/text5meg.txt -i files/text1meg.txt",
+    "regular files, 3 to 3 files, serial 4KB block I/O, fan-in/fan-out");
+
+enqueue(51,
+    "./parcat61 -o files/out1.txt -o files/out2.txt -o files/out3.txt -i files/text20meg.txt -i files/text5meg.txt -i files/text1meg.txt",
+    "regular files, 3 to 3 files, io61_copyall, fan-in/fan-out");
+
+enqueue(52,
+    "cat files/text20meg.txt | ./parcat61 -o files/out1.txt -o files/out2.txt -i /dev/stdin -i files/text5meg.txt",
+    "piped and regular files, 2 to 2 files, io61_copyall, fan-in/fan-out");
+
+
+
+# DIRECT I/O (inputs are decached before every trial, so the cached
+# KiB count only what the run itself left in the page cache)
+
+enqueue(53,
+    "./cat61 -d -o files/out.txt files/text20meg.txt",
+    "regular large file, O_DIRECT, sequential");
+
+enqueue(54,
+    "./cat61 -d -p -o files/out.txt files/text20meg.txt",
+    "regular large file, O_DIRECT, borrowed buffers, sequential");
+
+
+
+# COMPRESSED STREAMS (compare with the raw copies in tests 3 and 5)
+
+enqueue(55,
+    "./zcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, character I/O, lz61 compression, sequential");
+
+enqueue(56,
+    "./zcat61 -b 4096 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, lz61 compression, sequential");
+
+enqueue(57,
+    "./zcat61 files/text20meg.txt | ./zcat61 -u -o files/out.txt",
+    "regular large file, lz61 compression and decompression, sequential");
+
+
+
+# BACKWARD READS (compare with tests 15, 3, and 5)
+
+enqueue(58,
+    "./reverse61 -b 1 -o files/out.txt files/text20meg.txt",
+    "regular large file, character io61_read_backwards, reverse order");
+
+enqueue(59,
+    "./reverse61 -b 4096 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB io61_read_backwards, reverse order");
+
+
+
+# MAPPED OUTPUT (io61_setsize; compare with tests 20 and 38)
+
+enqueue(60,
+    "./reordercat61 -m -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, mapped output, random seek order");
+
+enqueue(61,
+    "./reordercat61 -m -b 512 -o files/out.txt files/text20meg.txt",
+    "regular large file, 512B block I/O, mapped output, random seek order");
+
+enqueue(62,
+    "./ostridecat61 -o files/out.txt files/text5meg.txt",
+    "regular medium file, character I/O, 1KB output stride order");
+
+enqueue(63,
+    "./ostridecat61 -m -o files/out.txt files/text5meg.txt",
+    "regular medium file, character I/O, mapped output, 1KB output stride order");
+
+
+
+# PREFETCHED RANDOM READS (inputs are decached before every trial;
+# compare with tests 20, 38, and 39)
+
+enqueue(64,
+    "./reordercat61 -f -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, prefetched, random seek order");
+
+enqueue(65,
+    "./reordercat61 -f -b 512 -o files/out.txt files/text20meg.txt",
+    "regular large file, 512B block I/O, prefetched, random seek order");
+
+enqueue(66,
+    "./reordercat61 -f -b 4096 -r 6582 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 4KB block I/O, prefetched, random seek order");
+
+
+
+# MANY FILES (each file gets its own io61 buffers; IO61_HUGEPAGES=1
+# carves them from huge pages)
+
+enqueue(67,
+    "./scattergather61 -b 512 -o files/out.txt "
+    . join(" ", map { "-i files/text8k.txt" } 1..300),
+    "300 gathered small files, 512B block I/O, sequential");
+
+enqueue(68,
+    "./scattergather61 -b 512 "
+    . join(" ", map { "-o files/out$_.txt" } 1..100)
+    . " -i files/text5meg.txt",
+    "medium file scattered to 100 files, 512B block I/O, sequential");
+
+
+
+# VECTORED I/O (the piped input is read with readv, and the outputs are
+# written with writev, 16 buffers per call)
+
+enqueue(69,
+    "cat files/text5meg.txt | ./scattergather61 -b 4096 -v 16 -o files/out1.txt -o files/out2.txt -o files/out3.txt -i files/text20meg.txt -i /dev/stdin",
+    "regular and piped files, 2 to 3 files, 16 x 4KB vectored I/O, fan-in/fan-out");
+
+
+
+# SHARED OUTPUT, BORROWED BUFFERS (IO61_SHARED files must refuse
+# io61_reserve and io61_commit; mtblockcat61 -p aborts if they don't)
+
+enqueue(70,
+    "./mtblockcat61 -p -b 4096 -j 4 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 4 threads, 4KB block I/O, shared output, reserve refused",
+    "no_content_check" => 1, "block_check" => 4096);
+
+enqueue(71,
+    "./mtblockcat61 -b 4096 -j 4 files/text20meg.txt | cat > files/out.txt",
+    "regular large file to pipe, 4 threads, 4KB block I/O, shared output",
+    "no_content_check" => 1, "block_check" => 4096);
+
+
+
+# ASYNCHRONOUS BACKWARD READS (compare with test 59)
+
+enqueue(72,
+    "./reverse61 -a -b 4096 -o files/out.txt files/text20meg.txt",
+    "regular large file, async 4KB io61_read_backwards, reverse order");
+
+
+if ($BENCH) {
+    bench();
+    bench_summary();
+} else {
+    run($sequentially);
+    summary();
+}
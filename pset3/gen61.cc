@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+
+// Usage: ./gen61 [-s SIZE] [-r SEED] [-l LINELEN] [-B] [-o OUTFILE]
+//    Writes SIZE bytes of synthetic test input to OUTFILE (default
+//    standard output). SIZE may end in K, M, or G. The same SEED and
+//    options always produce the same bytes, and a shorter file is a
+//    prefix of a longer one.
+//
+//    Text is made of words drawn from a fixed vocabulary with
+//    Zipf-distributed frequencies, so it compresses about like English.
+//    By default each line holds one word, like a dictionary file.
+//    LINELEN sets the length of lines filled with words: N (every line
+//    N bytes or a bit less), MIN-MAX (uniform), or MIN-MAX:MEAN
+//    (exponential with that mean, clamped to MIN-MAX). With `-B`, writes
+//    random binary data instead.
+//
+//    Unlike the other programs, gen61 doesn't use io61, so a broken io61
+//    can't corrupt the test inputs.
+
+#define GEN61_NWORDS    8192            // vocabulary size
+#define GEN61_WORDSLOT  16              // bytes per vocabulary entry
+#define GEN61_BUFSIZE   (1 << 20)
+
+
+// gen61_rng
+//    splitmix64: fast, and good enough for test data.
+
+struct gen61_rng {
+    uint64_t state;
+
+    explicit gen61_rng(uint64_t seed)
+        : state(seed) {
+    }
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    // Return a number in [0, n).
+    size_t below(size_t n) {
+        return (size_t) (((unsigned __int128) next() * n) >> 64);
+    }
+};
+
+
+// Vocabulary: `words[i]` holds word `i` of rank `i`, padded with newlines
+// so copying a whole slot is always safe; `wordlen[i]` is its length.
+// `zipf` maps 16 random bits to a rank with probability ~ 1/(rank+1).
+
+static char words[GEN61_NWORDS][GEN61_WORDSLOT];
+static unsigned char wordlen[GEN61_NWORDS];
+static uint16_t zipf[1 << 16];
+
+static void make_vocabulary() {
+    static const char* const syllables[] = {
+        "a", "e", "i", "o", "u", "ab", "al", "an", "ar", "as", "at", "be",
+        "ca", "ce", "ch", "co", "de", "di", "en", "er", "es", "ex", "ha",
+        "he", "in", "is", "it", "la", "le", "li", "lo", "ma", "me", "mi",
+        "mo", "na", "ne", "no", "on", "or", "ou", "pa", "pe", "po", "ra",
+        "re", "ri", "ro", "sa", "se", "si", "so", "st", "ta", "te", "th",
+        "ti", "to", "un", "ur", "ve", "wa", "we", "ing", "ion", "ent",
+        "ous", "ter", "ers", "est", "ble", "ment", "ness", "tion"
+    };
+    const size_t nsyllables = sizeof(syllables) / sizeof(syllables[0]);
+
+    gen61_rng rng(61);          // same vocabulary for every seed
+    for (size_t i = 0; i != GEN61_NWORDS; ++i) {
+        // frequent words are short
+        size_t maxsyl = i < 64 ? 2 : (i < 1024 ? 3 : 5);
+        size_t nsyl = 1 + rng.below(maxsyl);
+        size_t len = 0;
+        for (size_t s = 0; s != nsyl; ++s) {
+            const char* syl = syllables[rng.below(nsyllables)];
+            size_t sl = strlen(syl);
+            if (len + sl >= GEN61_WORDSLOT) {
+                break;
+            }
+            memcpy(&words[i][len], syl, sl);
+            len += sl;
+        }
+        memset(&words[i][len], '\n', GEN61_WORDSLOT - len);
+        wordlen[i] = len;
+    }
+
+    double total = 0;
+    for (size_t i = 0; i != GEN61_NWORDS; ++i) {
+        total += 1.0 / (i + 1);
+    }
+    double cdf = 0;
+    size_t rank = 0;
+    for (size_t z = 0; z != (1 << 16); ++z) {
+        while (rank + 1 < GEN61_NWORDS && cdf + 1.0 / (rank + 1) / total
+               < (z + 0.5) / (1 << 16)) {
+            cdf += 1.0 / (rank + 1) / total;
+            ++rank;
+        }
+        zipf[z] = rank;
+    }
+}
+
+
+// Line lengths: lines hold words until the next word would pass a
+// target length drawn for each line. `line_max == 0` means one word
+// per line.
+
+static size_t line_min = 0, line_max = 0;
+static double line_mean = 0;
+
+static size_t line_target(gen61_rng& rng) {
+    if (line_max == 0) {
+        return 0;
+    } else if (line_mean > 0) {
+        double u = (rng.next() >> 11) * 0x1.0p-53;
+        double x = line_min - log1p(-u) * (line_mean - line_min);
+        return x < line_max ? (size_t) x : line_max;
+    }
+    return line_min + rng.below(line_max - line_min + 1);
+}
+
+
+// parse_size(str, result)
+//    Parse a size with an optional K, M, or G suffix. Returns false if
+//    `str` isn't one.
+
+static bool parse_size(const char* str, size_t* result) {
+    char* end;
+    unsigned long long n = strtoull(str, &end, 0);
+    if (end == str) {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k') {
+        n <<= 10, ++end;
+    } else if (*end == 'M' || *end == 'm') {
+        n <<= 20, ++end;
+    } else if (*end == 'G' || *end == 'g') {
+        n <<= 30, ++end;
+    }
+    *result = n;
+    return *end == '\0';
+}
+
+static bool parse_line_lengths(const char* str) {
+    char* end;
+    line_min = line_max = strtoul(str, &end, 0);
+    if (*end == '-') {
+        line_max = strtoul(end + 1, &end, 0);
+    }
+    if (*end == ':') {
+        line_mean = strtod(end + 1, &end);
+        if (line_mean < line_min || line_mean > line_max) {
+            return false;
+        }
+    }
+    return *end == '\0' && line_max > 0 && line_min <= line_max;
+}
+
+
+// write_all(fd, buf, sz)
+//    Write all of `buf`, retrying short writes. Exits on error.
+
+static void write_all(int fd, const char* buf, size_t sz) {
+    while (sz != 0) {
+        ssize_t w = write(fd, buf, sz);
+        if (w > 0) {
+            buf += w;
+            sz -= w;
+        } else if (w == -1 && errno != EINTR && errno != EAGAIN) {
+            perror("gen61: write");
+            exit(1);
+        }
+    }
+}
+
+
+[[noreturn]] static void usage(const char* program_name) {
+    fprintf(stderr, "Usage: %s [-s SIZE] [-r SEED] [-l LINELEN] [-B] [-o OUTFILE]\n",
+            program_name);
+    exit(1);
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t size = 1 << 20;
+    uint64_t seed = 0;
+    bool binary = false;
+    const char* output_file = nullptr;
+
+    int arg;
+    while ((arg = getopt(argc, argv, "s:r:l:Bo:")) != -1) {
+        switch (arg) {
+        case 's':
+            if (!parse_size(optarg, &size)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'r':
+            seed = strtoull(optarg, nullptr, 0);
+            break;
+        case 'l':
+            if (!parse_line_lengths(optarg)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'B':
+            binary = true;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+    }
+
+    int fd = STDOUT_FILENO;
+    if (output_file) {
+        fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd == -1) {
+            perror(output_file);
+            exit(1);
+        }
+    }
+
+    // Leave room past the end of the buffer for a whole line, so the
+    // inner loop needn't check space word by word.
+    size_t slack = 2 * GEN61_WORDSLOT + line_max;
+    char* buf = new char[GEN61_BUFSIZE + slack];
+    gen61_rng rng(seed);
+    if (!binary) {
+        make_vocabulary();
+    }
+
+    size_t len = 0;             // bytes in `buf` (may pass GEN61_BUFSIZE)
+    int pending = -1;           // word that didn't fit on the last line
+    while (size != 0) {
+        if (binary) {
+            for (len = 0; len < GEN61_BUFSIZE; len += 8) {
+                uint64_t x = rng.next();
+                memcpy(&buf[len], &x, 8);
+            }
+        } else {
+            while (len < GEN61_BUFSIZE) {
+                size_t target = line_target(rng);
+                size_t start = len;
+                while (true) {
+                    unsigned w = pending >= 0 ? pending : zipf[rng.next() >> 48];
+                    pending = -1;
+                    if (len != start) {
+                        if (len - start + 1 + wordlen[w] > target) {
+                            pending = w;    // starts the next line
+                            break;
+                        }
+                        buf[len++] = ' ';
+                    }
+                    memcpy(&buf[len], words[w], GEN61_WORDSLOT);
+                    len += wordlen[w];
+                }
+                buf[len++] = '\n';
+            }
+        }
+        size_t n = len < GEN61_BUFSIZE ? len : GEN61_BUFSIZE;
+        n = n < size ? n : size;
+        write_all(fd, buf, n);
+        size -= n;
+        memmove(buf, &buf[n], len - n);
+        len -= n;
+    }
+
+    delete[] buf;
+    if (fd != STDOUT_FILENO && close(fd) == -1) {
+        perror(output_file);
+        exit(1);
+    }
+}
@@ -1,83 +1,2181 @@
 #include "io61.hh"
+#include "lz61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 // io61.c
-//    YOUR CODE HERE!
+//    Buffered I/O on top of file descriptors. Read-only regular files
+//    are memory-mapped; other read-only files are served from a small
+//    associative page cache. Write-only files buffer output in a single
+//    block; once a writer seeks, its blocks are held as dirty extents
+//    and written back in file order. A writer whose final size is known
+//    (io61_setsize) writes straight into a shared mapping of the file.
+//    Compressed streams (io61_zopen) hand their buffers to a helper
+//    thread that runs the lz61 codec.
+
+
+// Cache geometry. Override with, e.g., `make DEFS=-DIO61_NSLOTS=64`.
+
+#ifndef IO61_NSLOTS
+#define IO61_NSLOTS 32
+#endif
+#ifndef IO61_SLOTSIZE
+#define IO61_SLOTSIZE 4096
+#endif
+#ifndef IO61_READAHEAD
+#define IO61_READAHEAD 16       // max slots filled by one read
+#endif
+#ifndef IO61_DIRTY_MAX
+#define IO61_DIRTY_MAX (64 << 20) // max out-of-order bytes held for writing
+#endif
+#ifndef IO61_NAGLE_NS
+#define IO61_NAGLE_NS 200000  // max age of buffered data on a paired writer
+#endif
+#ifndef IO61_ASYNC_DEPTH
+#define IO61_ASYNC_DEPTH 4      // IO61_ASYNC buffers in flight
+#endif
+#ifndef IO61_ASYNC_BUFSIZE
+#define IO61_ASYNC_BUFSIZE 65536
+#endif
+#ifndef IO61_DIRECT_BUFSIZE
+#define IO61_DIRECT_BUFSIZE (1 << 20) // IO61_DIRECT bytes per system call
+#endif
+#ifndef IO61_DIRECT_ALIGN
+#define IO61_DIRECT_ALIGN 4096  // O_DIRECT offset, length, and memory alignment
+#endif
+#ifndef IO61_HUGEPAGE
+#define IO61_HUGEPAGE (2 << 20) // huge page size for IO61_HUGEPAGES=1
+#endif
+static_assert(IO61_NSLOTS > 0, "IO61_NSLOTS must be positive");
+static_assert(IO61_DIRECT_BUFSIZE % IO61_DIRECT_ALIGN == 0,
+              "IO61_DIRECT_BUFSIZE must be a multiple of IO61_DIRECT_ALIGN");
+static_assert(IO61_READAHEAD > 0 && IO61_READAHEAD <= IO61_NSLOTS,
+              "IO61_READAHEAD must be in [1, IO61_NSLOTS]");
+static_assert((IO61_SLOTSIZE & (IO61_SLOTSIZE - 1)) == 0,
+              "IO61_SLOTSIZE must be a power of two");
+static_assert(IO61_HUGEPAGE % IO61_DIRECT_ALIGN == 0,
+              "IO61_HUGEPAGE must be a multiple of IO61_DIRECT_ALIGN");
+
+// Largest read or write buffer an io61_file will grow to.
+static constexpr size_t io61_bufmax = IO61_READAHEAD * IO61_SLOTSIZE;
+
+static constexpr size_t io61_nbuckets = [] {
+    size_t n = 1;
+    while (n < 2 * IO61_NSLOTS) {
+        n *= 2;
+    }
+    return n;
+}();
+
+
+// io61_slot
+//    One page of the read cache. `off` is the file offset of `buf[0]`
+//    (a multiple of IO61_SLOTSIZE), or -1 if the slot is empty.
+
+struct io61_slot {
+    off_t off = -1;
+    size_t len = 0;             // number of valid bytes in `buf`
+    bool referenced = false;    // CLOCK reference bit
+    int next = -1;              // next slot in hash chain
+    unsigned char* buf = nullptr;
+};
+
+
+// io61_async
+//    Read-ahead state for files opened with IO61_ASYNC. A helper thread
+//    reads the file into a ring of buffers while the caller consumes
+//    them. Buffer `head` is the one the read window points into; `tail`
+//    is the next one the helper fills. Seeking bumps `gen`, which makes
+//    the helper discard in-flight data and restart at `next_off`.
+//    Compressed streams use the same ring: a reader's helper fills it
+//    with decompressed blocks, and a writer's helper empties it, with
+//    `head` the buffer being written and `tail` the next to compress.
+
+struct io61_async {
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    unsigned char* buf[IO61_ASYNC_DEPTH];
+    size_t bufsize;
+    unsigned char* zbuf = nullptr; // one compressed block (io61_zopen)
+    size_t len[IO61_ASYNC_DEPTH];
+    off_t off[IO61_ASYNC_DEPTH];
+    bool full[IO61_ASYNC_DEPTH] = {};
+    unsigned head = 0;
+    unsigned tail = 0;
+    off_t next_off;             // where the helper reads next
+    unsigned gen = 0;
+    bool eof = false;           // helper hit end of file or an error
+    int err = 0;                // errno of the helper's failed read
+    bool stop = false;
+    int wakefd;                 // eventfd that interrupts a blocked helper
+};
+
+
+// io61_pattern
+//    Access pattern observed on a read-only file.
+
+enum io61_pattern {
+    io61_pattern_unknown,
+    io61_pattern_sequential,    // reads continue where the last one ended
+    io61_pattern_reverse,       // each seek jumps back by the same amount
+    io61_pattern_strided,       // each seek jumps forward by the same amount
+    io61_pattern_random         // seeks keep jumping by different amounts
+};
+
+
+// io61_dirty
+//    A block of written data waiting for write-behind. `valid` marks the
+//    bytes that have been written.
+
+struct io61_dirty {
+    unsigned char buf[IO61_SLOTSIZE];
+    uint64_t valid[(IO61_SLOTSIZE + 63) / 64] = {};
+    size_t nvalid = 0;
+};
 
 
 // io61_file
-//    Data structure for io61 file wrappers. Add your own stuff.
+//    Data structure for io61 file wrappers.
+//
+//    Reads go through a window `rbuf[0..rend)` covering file offsets
+//    `[rtag, rtag + rend)`; the file position is `rtag + rpos`. Writes
+//    go through `wbuf[0..wpos)`, covering offsets `[wtag, wtag + wpos)`.
+//    `rsize` and `wsize` adapt to the caller: they start at the file's
+//    st_blksize, grow (up to io61_bufmax) for large sequential requests,
+//    and shrink back for random reads.
+//    Once a writer seeks, data leaving `wbuf` is copied into `dirty`, a
+//    map of aligned blocks with per-byte valid masks, and is written to
+//    the file in offset order by io61_flush.
+
+struct io61_file {
+    int fd;
+    int mode;
+    bool seekable;
+    mode_t ftype;               // S_IFMT bits of the file's mode
+    off_t fdpos;                // file descriptor's own position
+
+    // read window
+    unsigned char* rbuf = nullptr;
+    off_t rtag = 0;
+    size_t rpos = 0;
+    size_t rend = 0;
+    size_t rsize = IO61_SLOTSIZE; // bytes per read system call
+
+    // asynchronous read-ahead (IO61_ASYNC), or compression helper
+    // (IO61_LZ61)
+    io61_async* async = nullptr;
+    bool compressed = false;    // IO61_LZ61: buffers hold uncompressed data
+
+    // read mapping (regular files only), or a writer's output mapping
+    // (io61_setsize), which is then also `wbuf`
+    unsigned char* map = nullptr;
+    size_t mapsize = 0;
+
+    // read cache
+    io61_slot* slots = nullptr;
+    unsigned char* slotmem = nullptr;
+    int buckets[io61_nbuckets];
+    unsigned hand = 0;          // CLOCK hand
+
+    // access pattern detector
+    io61_pattern pattern = io61_pattern_unknown;
+    off_t last_jump = 0;        // most recent change in file position
+    int streak = 0;             // number of consecutive equal jumps
+    int scattered = 0;          // number of consecutive unequal jumps
+    io61_pattern advised = io61_pattern_sequential; // madvise()d pattern
+
+    // write buffer
+    unsigned char* wbuf = nullptr;
+    off_t wtag = 0;
+    size_t wpos = 0;
+    size_t wsize = IO61_SLOTSIZE; // bytes buffered before writing
+    bool shared = false;        // IO61_SHARED: writers may be concurrent
+    std::atomic<bool> wlock{false}; // IO61_SHARED: guards the write buffer
+    uint64_t wticket = 0;       // IO61_SHARED: next write ticket (`wlock`)
+    uint64_t wturn = 0;         // IO61_SHARED pipes: ticket now writing
+    std::mutex wturnlock;       // guards `wturn`
+    std::condition_variable wturncv;
+
+    // paired pipe/socket mode (see io61_pair)
+    io61_file* partner = nullptr;
+    std::vector<unsigned char> backlog; // input drained while writing
+    size_t backpos = 0;
+    uint64_t wsince = 0;        // when `wbuf` became non-empty (ns)
+
+    // write-behind blocks, keyed by aligned offset
+    std::unordered_map<off_t, std::unique_ptr<io61_dirty>> dirty;
+    size_t ndirty = 0;          // total bytes in `dirty` blocks
+
+    // uncached transfers (IO61_DIRECT only)
+    unsigned char* dbuf = nullptr; // aligned pool buffer: read window or `wbuf`
+    bool direct = false;        // O_DIRECT currently set on `fd`
+};
+
+
+// Statistics
+//    Each thread counts into its own io61_stats. The main thread's is
+//    io61_stat itself; other threads (the IO61_ASYNC helper, or the
+//    caller's own threads) count into a thread-local copy that is
+//    merged into io61_stat when the thread exits.
+
+struct io61_thread_stats {
+    io61_stats s = {};
+    ~io61_thread_stats();
+};
+
+static const std::thread::id io61_main_thread = std::this_thread::get_id();
+static thread_local io61_thread_stats io61_tstats;
+static thread_local io61_stats* io61_my =
+    std::this_thread::get_id() == io61_main_thread ? &io61_stat
+                                                   : &io61_tstats.s;
+static std::mutex io61_stat_lock;
+
+io61_thread_stats::~io61_thread_stats() {
+    std::lock_guard<std::mutex> guard(io61_stat_lock);
+    io61_stat.cache_hits += s.cache_hits;
+    io61_stat.cache_misses += s.cache_misses;
+    io61_stat.read_calls += s.read_calls;
+    io61_stat.write_calls += s.write_calls;
+    io61_stat.seek_calls += s.seek_calls;
+    io61_stat.mmap_calls += s.mmap_calls;
+    io61_stat.bytes_read += s.bytes_read;
+    io61_stat.bytes_written += s.bytes_written;
+    io61_stat.bytes_copied += s.bytes_copied;
+    io61_stat.direct_files += s.direct_files;
+    io61_stat.cached_bytes += s.cached_bytes;
+    io61_stat.zplain_bytes += s.zplain_bytes;
+    io61_stat.zpacked_bytes += s.zpacked_bytes;
+    io61_stat.read_bufsize = std::max(io61_stat.read_bufsize, s.read_bufsize);
+    io61_stat.write_bufsize = std::max(io61_stat.write_bufsize,
+                                       s.write_bufsize);
+    for (int op = 0; op != io61_nlat; ++op) {
+        for (int b = 0; b != IO61_HIST_NBUCKETS; ++b) {
+            io61_stat.latency[op].count[b] += s.latency[op].count[b];
+        }
+    }
+}
+
+
+// Latency histograms
+//    With IO61_LATENCY=1 in the environment, system calls and the main
+//    io61 operations are timed into io61_my->latency. An io61_timer
+//    times one call of an operation; calls nested inside another call
+//    of the same operation aren't counted separately.
+
+static const bool io61_timing = [] {
+    const char* s = getenv("IO61_LATENCY");
+    return s && strcmp(s, "0") != 0;
+}();
+static thread_local unsigned io61_timing_depth[io61_nlat];
+
+static inline uint64_t io61_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Return the time if latency is being measured, else 0.
+static inline uint64_t io61_clock_start() {
+    return io61_timing ? io61_clock() : 0;
+}
+
+static inline void io61_time(io61_latency_op op, uint64_t start) {
+    if (start) {
+        io61_my->latency[op].add(io61_clock() - start);
+    }
+}
+
+struct io61_timer {
+    io61_latency_op op;
+    uint64_t start = 0;
+
+    explicit io61_timer(io61_latency_op op_)
+        : op(op_) {
+        if (io61_timing && io61_timing_depth[op]++ == 0) {
+            start = io61_clock();
+        }
+    }
+    ~io61_timer() {
+        if (io61_timing) {
+            --io61_timing_depth[op];
+            io61_time(op, start);
+        }
+    }
+};
+
+static inline void io61_count_read(ssize_t r, uint64_t start) {
+    ++io61_my->read_calls;
+    io61_my->bytes_read += r > 0 ? r : 0;
+    io61_time(io61_lat_sysread, start);
+}
+
+static inline void io61_count_write(ssize_t r, uint64_t start) {
+    ++io61_my->write_calls;
+    io61_my->bytes_written += r > 0 ? r : 0;
+    io61_time(io61_lat_syswrite, start);
+}
+
+static inline void* io61_memcpy(void* dst, const void* src, size_t n) {
+    io61_my->bytes_copied += n;
+    return memcpy(dst, src, n);
+}
+
+// io61_memrcpy(dst, src, n)
+//    Like io61_memcpy, but reverses the bytes: `dst[i] = src[n - 1 - i]`.
+//    Copies eight bytes at a time with a byte swap.
+
+static inline void* io61_memrcpy(void* dst, const void* src, size_t n) {
+    io61_my->bytes_copied += n;
+    unsigned char* d = (unsigned char*) dst;
+    const unsigned char* s = (const unsigned char*) src + n;
+    for (; n >= 8; n -= 8, d += 8) {
+        uint64_t x;
+        s -= 8;
+        memcpy(&x, s, 8);
+        x = __builtin_bswap64(x);
+        memcpy(d, &x, 8);
+    }
+    while (n--) {
+        *d++ = *--s;
+    }
+    return dst;
+}
+
+
+// Buffer pool
+//    Read caches, write buffers, and the IO61_ASYNC, IO61_DIRECT, and
+//    lz61 buffers come from a process-wide pool with a free list per
+//    power-of-two size class, so opening and closing many files reuses
+//    buffers instead of going back to the allocator. Freed buffers stay
+//    in the pool until the process exits. Buffers are aligned for
+//    O_DIRECT.
+//
+//    With IO61_HUGEPAGES=1 in the environment, buffers smaller than a
+//    huge page are carved from huge-page arenas (MAP_HUGETLB if the
+//    system has huge pages reserved, else transparent huge pages), so
+//    many files' buffers share a few TLB entries.
+
+static constexpr size_t io61_pool_align = std::max(4096, IO61_DIRECT_ALIGN);
+static constexpr int io61_pool_nclasses = 48;
+
+static std::mutex io61_pool_lock;
+static std::vector<unsigned char*> io61_pool[io61_pool_nclasses];
+static unsigned char* io61_arena = nullptr;
+static size_t io61_arena_left = 0;
+
+static const bool io61_hugepages = [] {
+    const char* s = getenv("IO61_HUGEPAGES");
+    return s && strcmp(s, "0") != 0;
+}();
+
+static inline int io61_pool_class(size_t sz) {
+    int c = 12;
+    while (((size_t) 1 << c) < sz) {
+        ++c;
+    }
+    return c;
+}
+
+// io61_arena_get(sz)
+//    Carve `sz` bytes from the current huge-page arena, starting a new
+//    one if it's too full. Returns nullptr on failure. Call with
+//    `io61_pool_lock` held.
+
+static unsigned char* io61_arena_get(size_t sz) {
+    if (io61_arena_left < sz) {
+        void* a = mmap(nullptr, IO61_HUGEPAGE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        ++io61_my->mmap_calls;
+        if (a == MAP_FAILED) {
+            // Transparent huge pages need a huge-page-aligned range.
+            a = mmap(nullptr, 2 * IO61_HUGEPAGE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            ++io61_my->mmap_calls;
+            if (a == MAP_FAILED) {
+                return nullptr;
+            }
+            uintptr_t x = (uintptr_t) a;
+            uintptr_t start = (x + IO61_HUGEPAGE - 1) & ~(uintptr_t) (IO61_HUGEPAGE - 1);
+            if (start != x) {
+                munmap(a, start - x);
+            }
+            munmap((void*) (start + IO61_HUGEPAGE), x + IO61_HUGEPAGE - start);
+            a = (void*) start;
+            madvise(a, IO61_HUGEPAGE, MADV_HUGEPAGE);
+            io61_my->mmap_calls += 3;
+        }
+        io61_arena = (unsigned char*) a;
+        io61_arena_left = IO61_HUGEPAGE;
+    }
+    unsigned char* buf = io61_arena;
+    io61_arena += sz;
+    io61_arena_left -= sz;
+    return buf;
+}
+
+// io61_pool_get(sz)
+//    Return a buffer of at least `sz` bytes. Throws std::bad_alloc if
+//    there's no memory.
+
+static unsigned char* io61_pool_get(size_t sz) {
+    int c = io61_pool_class(sz);
+    std::lock_guard<std::mutex> guard(io61_pool_lock);
+    if (!io61_pool[c].empty()) {
+        unsigned char* buf = io61_pool[c].back();
+        io61_pool[c].pop_back();
+        return buf;
+    }
+    size_t csize = (size_t) 1 << c;
+    unsigned char* buf = nullptr;
+    if (io61_hugepages && csize <= IO61_HUGEPAGE) {
+        buf = io61_arena_get(csize);
+    }
+    void* mem;
+    if (!buf && posix_memalign(&mem, io61_pool_align, csize) == 0) {
+        buf = (unsigned char*) mem;
+    }
+    if (!buf) {
+        throw std::bad_alloc();
+    }
+    return buf;
+}
+
+// io61_pool_put(buf, sz)
+//    Return `buf`, which io61_pool_get(sz) returned, to the pool.
+
+static void io61_pool_put(unsigned char* buf, size_t sz) {
+    if (buf) {
+        std::lock_guard<std::mutex> guard(io61_pool_lock);
+        io61_pool[io61_pool_class(sz)].push_back(buf);
+    }
+}
+
+
+// Direct I/O (IO61_DIRECT)
+//    Regular files opened with IO61_DIRECT move data with O_DIRECT, so
+//    large sequential transfers neither double-buffer in the page cache
+//    nor evict other files' pages. O_DIRECT needs aligned memory, file
+//    offsets, and lengths: each file gets an aligned buffer from the
+//    pool, and unaligned pieces at the start and end of a write go
+//    through the page cache with O_DIRECT turned off.
+
+
+// io61_set_direct(f, on)
+//    Turn O_DIRECT on or off for `f`'s file descriptor. Returns 0 on
+//    success and -1 on error, for instance if the file system doesn't
+//    support O_DIRECT.
+
+static int io61_set_direct(io61_file* f, bool on) {
+    if (f->direct != on) {
+        int fl = fcntl(f->fd, F_GETFL);
+        if (fl == -1
+            || fcntl(f->fd, F_SETFL, on ? fl | O_DIRECT : fl & ~O_DIRECT) == -1) {
+            return -1;
+        }
+        f->direct = on;
+    }
+    return 0;
+}
+
+
+// io61_resident(f)
+//    Return the number of bytes of `f`'s file that are in the page cache.
+//    This maps the whole file, so it's only used while profiling.
+
+static size_t io61_resident(io61_file* f) {
+    int fd = f->fd;
+    if (f->mode != O_RDONLY) {
+        // mmap needs read access
+        char name[64];
+        snprintf(name, sizeof(name), "/proc/self/fd/%d", f->fd);
+        fd = open(name, O_RDONLY);
+    }
+    struct stat st;
+    size_t resident = 0;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ++io61_my->mmap_calls;
+        if (map != MAP_FAILED) {
+            size_t pgsize = sysconf(_SC_PAGESIZE);
+            size_t npages = (st.st_size + pgsize - 1) / pgsize;
+            std::vector<unsigned char> vec(npages);
+            if (mincore(map, st.st_size, vec.data()) == 0) {
+                for (unsigned char v : vec) {
+                    resident += (v & 1) * pgsize;
+                }
+                resident = std::min(resident, (size_t) st.st_size);
+            }
+            munmap(map, st.st_size);
+            ++io61_my->mmap_calls;
+        }
+    }
+    if (fd >= 0 && fd != f->fd) {
+        close(fd);
+    }
+    return resident;
+}
+
+
+// io61_async_run(f)
+//    Body of the read-ahead helper thread for `f`.
+
+static void io61_async_run(io61_file* f) {
+    io61_async* a = f->async;
+    std::unique_lock<std::mutex> guard(a->m);
+    while (true) {
+        a->cv.wait(guard, [a] {
+            return a->stop || (!a->eof && !a->full[a->tail]);
+        });
+        if (a->stop) {
+            break;
+        }
+        unsigned i = a->tail, gen = a->gen;
+        off_t off = a->next_off;
+        guard.unlock();
+
+        ssize_t n = -1;
+        int err = 0;
+        while (true) {
+            if (!f->seekable) {
+                // Wait for data in poll() so io61_close can wake us.
+                struct pollfd pfd[2] = {{f->fd, POLLIN, 0},
+                                        {a->wakefd, POLLIN, 0}};
+                int p = poll(pfd, 2, -1);
+                if (p < 0 && errno == EINTR) {
+                    continue;
+                } else if (p < 0) {
+                    err = errno;
+                    break;
+                } else if (pfd[1].revents) {
+                    break;
+                }
+            }
+            uint64_t t0 = io61_clock_start();
+            if (f->seekable) {
+                n = pread(f->fd, a->buf[i], IO61_ASYNC_BUFSIZE, off);
+            } else {
+                n = read(f->fd, a->buf[i], IO61_ASYNC_BUFSIZE);
+            }
+            io61_count_read(n, t0);
+            if (n >= 0 || (errno != EINTR && errno != EAGAIN)) {
+                err = n < 0 ? errno : 0;
+                break;
+            }
+        }
+
+        guard.lock();
+        if (a->stop) {
+            break;
+        }
+        if (gen != a->gen) {
+            continue;           // caller seeked; data is stale
+        }
+        if (n <= 0) {
+            a->eof = true;
+            a->err = n < 0 ? err : 0;
+        } else {
+            a->len[i] = n;
+            a->off[i] = off;
+            a->full[i] = true;
+            a->next_off += n;
+            a->tail = (i + 1) % IO61_ASYNC_DEPTH;
+        }
+        a->cv.notify_all();
+    }
+}
+
+
+// io61_zget(f, buf, sz)
+//    Read `sz` bytes of compressed data for `f`'s decompression helper,
+//    returning fewer only at end of file. Returns -1 on error or if
+//    io61_close is waiting for the helper.
+
+static ssize_t io61_zget(io61_file* f, unsigned char* buf, size_t sz) {
+    io61_async* a = f->async;
+    size_t n = 0;
+    while (n != sz) {
+        if (!f->seekable) {
+            struct pollfd pfd[2] = {{f->fd, POLLIN, 0},
+                                    {a->wakefd, POLLIN, 0}};
+            int p = poll(pfd, 2, -1);
+            if (p < 0 && errno == EINTR) {
+                continue;
+            } else if (p < 0 || pfd[1].revents) {
+                return -1;
+            }
+        }
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = read(f->fd, buf + n, sz - n);
+        io61_count_read(r, t0);
+        if (r > 0) {
+            n += r;
+        } else if (r == 0) {
+            break;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+
+// io61_zread_run(f)
+//    Body of the decompression helper thread for a compressed reader:
+//    reads lz61 blocks and unpacks each into the next free buffer.
+
+static void io61_zread_run(io61_file* f) {
+    io61_async* a = f->async;
+    std::unique_lock<std::mutex> guard(a->m);
+    while (true) {
+        a->cv.wait(guard, [a] {
+            return a->stop || (!a->eof && !a->full[a->tail]);
+        });
+        if (a->stop) {
+            break;
+        }
+        unsigned i = a->tail;
+        guard.unlock();
+
+        unsigned char hdr[LZ61_HEADER];
+        size_t packed = 0, plain = 0;
+        ssize_t n = io61_zget(f, hdr, LZ61_HEADER);
+        if (n > 0
+            && (n != LZ61_HEADER
+                || lz61_header(hdr, &packed, &plain) < 0
+                || io61_zget(f, a->zbuf, packed) != (ssize_t) packed
+                || lz61_unpack(a->buf[i], a->zbuf, packed, plain) < 0)) {
+            n = -1;             // truncated or corrupt block
+        }
+        if (n > 0) {
+            io61_my->zplain_bytes += plain;
+            io61_my->zpacked_bytes += LZ61_HEADER + packed;
+        }
+
+        guard.lock();
+        if (a->stop) {
+            break;
+        }
+        if (n <= 0) {
+            a->eof = true;
+            a->err = n < 0 ? EIO : 0;
+        } else {
+            a->len[i] = plain;
+            a->off[i] = a->next_off;
+            a->full[i] = true;
+            a->next_off += plain;
+            a->tail = (i + 1) % IO61_ASYNC_DEPTH;
+        }
+        a->cv.notify_all();
+    }
+}
+
+
+// io61_zwrite_run(f)
+//    Body of the compression helper thread for a compressed writer:
+//    packs each buffer the caller hands over into an lz61 block and
+//    writes it. After an error, later buffers are dropped and the caller
+//    sees the error at its next drain or flush.
+
+static ssize_t io61_syswrite(io61_file* f, off_t off, const unsigned char* buf,
+                             size_t sz);
+
+static void io61_zwrite_run(io61_file* f) {
+    io61_async* a = f->async;
+    std::unique_lock<std::mutex> guard(a->m);
+    while (true) {
+        a->cv.wait(guard, [a] { return a->stop || a->full[a->tail]; });
+        if (!a->full[a->tail]) {
+            break;
+        }
+        unsigned i = a->tail;
+        bool failed = a->err != 0;
+        guard.unlock();
+
+        int err = 0;
+        if (!failed) {
+            size_t n = lz61_pack(a->zbuf, a->buf[i], a->len[i]);
+            io61_my->zplain_bytes += a->len[i];
+            io61_my->zpacked_bytes += n;
+            if (io61_syswrite(f, f->fdpos, a->zbuf, n) != (ssize_t) n) {
+                err = errno ? errno : EIO;
+            }
+        }
+
+        guard.lock();
+        if (err) {
+            a->err = err;
+        }
+        a->full[i] = false;
+        a->tail = (i + 1) % IO61_ASYNC_DEPTH;
+        a->cv.notify_all();
+    }
+}
+
+
+// io61_async_start(f), io61_async_stop(f)
+//    Create and destroy the read-ahead or compression helper for `f`.
+
+static void io61_async_start(io61_file* f) {
+    io61_async* a = f->async = new io61_async;
+    a->bufsize = f->compressed ? LZ61_BLOCKSIZE : IO61_ASYNC_BUFSIZE;
+    for (int i = 0; i != IO61_ASYNC_DEPTH; ++i) {
+        a->buf[i] = io61_pool_get(a->bufsize);
+    }
+    a->next_off = f->rtag;
+    a->wakefd = eventfd(0, EFD_CLOEXEC);
+    if (!f->compressed) {
+        a->thread = std::thread(io61_async_run, f);
+        return;
+    }
+    a->zbuf = io61_pool_get(LZ61_HEADER + lz61_bound(LZ61_BLOCKSIZE));
+    if (f->mode == O_RDONLY) {
+        a->thread = std::thread(io61_zread_run, f);
+    } else {
+        f->wbuf = a->buf[0];
+        f->wsize = LZ61_BLOCKSIZE;
+        a->thread = std::thread(io61_zwrite_run, f);
+    }
+}
+
+static void io61_async_stop(io61_file* f) {
+    io61_async* a = f->async;
+    {
+        std::lock_guard<std::mutex> guard(a->m);
+        a->stop = true;
+        a->cv.notify_all();
+    }
+    uint64_t one = 1;
+    ssize_t w = write(a->wakefd, &one, sizeof(one));
+    (void) w;
+    a->thread.join();
+    close(a->wakefd);
+    for (int i = 0; i != IO61_ASYNC_DEPTH; ++i) {
+        io61_pool_put(a->buf[i], a->bufsize);
+    }
+    io61_pool_put(a->zbuf, LZ61_HEADER + lz61_bound(LZ61_BLOCKSIZE));
+    delete a;
+    f->async = nullptr;
+}
+
+
+// io61_async_fill(f, pos)
+//    io61_fill for IO61_ASYNC files: release the buffer behind the read
+//    window and wait for the one that holds `pos`, restarting the helper
+//    if `pos` isn't where it's reading.
+
+static ssize_t io61_async_fill(io61_file* f, off_t pos) {
+    io61_async* a = f->async;
+    std::unique_lock<std::mutex> guard(a->m);
+    if (f->rbuf) {
+        a->full[a->head] = false;
+        a->head = (a->head + 1) % IO61_ASYNC_DEPTH;
+        f->rbuf = nullptr;
+        a->cv.notify_all();
+    }
+
+    bool restart = false;
+    if (a->full[a->head]) {
+        restart = pos < a->off[a->head]
+            || pos >= a->off[a->head] + (off_t) a->len[a->head];
+    } else {
+        restart = pos != a->next_off;
+    }
+    if (restart) {
+        if (!f->seekable) {
+            errno = ESPIPE;
+            return -1;
+        }
+        ++a->gen;
+        for (int i = 0; i != IO61_ASYNC_DEPTH; ++i) {
+            a->full[i] = false;
+        }
+        a->head = a->tail = 0;
+        a->next_off = pos - (pos % IO61_SLOTSIZE);
+        a->eof = false;
+        a->err = 0;
+        a->cv.notify_all();
+    }
+
+    a->cv.wait(guard, [a] { return a->full[a->head] || a->eof; });
+    if (!a->full[a->head]) {
+        f->rtag = pos;
+        f->rpos = f->rend = 0;
+        errno = a->err;
+        return a->err ? -1 : 0;
+    }
+    f->rbuf = a->buf[a->head];
+    f->rtag = a->off[a->head];
+    f->rpos = pos - f->rtag;
+    f->rend = a->len[a->head];
+    return f->rend - f->rpos;
+}
+
+
+// io61_fdopen(fd, mode)
+//    Return a new io61_file for file descriptor `fd`. `mode` is
+//    either O_RDONLY for a read-only file or O_WRONLY for a
+//    write-only file. You need not support read/write files.
+//    Or IO61_ASYNC into a read-only `mode` to read ahead in a helper
+//    thread, or IO61_DIRECT to bypass the page cache for a regular file
+//    (ignored where O_DIRECT is unsupported). IO61_LZ61 makes `f` an
+//    lz61 compressed stream; see io61_zopen.
+
+io61_file* io61_fdopen(int fd, int mode) {
+    assert(fd >= 0);
+    io61_file* f = new io61_file;
+    f->fd = fd;
+    f->mode = mode & O_ACCMODE;
+    f->shared = f->mode != O_RDONLY && (mode & IO61_SHARED)
+        && !(mode & IO61_LZ61);
+    f->fdpos = lseek(fd, 0, SEEK_CUR);
+    ++io61_my->seek_calls;
+    f->seekable = f->fdpos != (off_t) -1;
+    if (!f->seekable) {
+        f->fdpos = 0;
+    }
+    f->rtag = f->wtag = f->fdpos;
+    for (size_t i = 0; i != io61_nbuckets; ++i) {
+        f->buckets[i] = -1;
+    }
+    struct stat st;
+    f->ftype = fstat(fd, &st) == 0 ? st.st_mode & S_IFMT : 0;
+    if (f->ftype) {
+        size_t blksize = IO61_SLOTSIZE;
+        while (blksize < (size_t) st.st_blksize && blksize < io61_bufmax) {
+            blksize *= 2;
+        }
+        f->rsize = f->wsize = blksize;
+    }
+    if (mode & IO61_LZ61) {
+        // offsets count uncompressed bytes
+        f->compressed = true;
+        f->rtag = f->wtag = 0;
+        io61_async_start(f);
+        return f;
+    }
+    if ((mode & IO61_DIRECT) && S_ISREG(f->ftype) && !f->shared
+        && !(mode & IO61_ASYNC) && io61_set_direct(f, true) == 0) {
+        f->dbuf = io61_pool_get(IO61_DIRECT_BUFSIZE);
+        f->rsize = f->wsize = IO61_DIRECT_BUFSIZE;
+        if (f->mode != O_RDONLY) {
+            f->wbuf = f->dbuf;
+        }
+        return f;
+    }
+    if (f->mode == O_RDONLY && (mode & IO61_ASYNC)) {
+        io61_async_start(f);
+        return f;
+    }
+    if (f->mode == O_RDONLY
+        && S_ISREG(f->ftype)
+        && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ++io61_my->mmap_calls;
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            ++io61_my->mmap_calls;
+            f->map = f->rbuf = (unsigned char*) map;
+            f->mapsize = f->rend = st.st_size;
+            f->rtag = 0;
+            f->rpos = f->fdpos;
+            return f;
+        }
+    }
+    if (f->mode == O_RDONLY) {
+        f->slots = new io61_slot[IO61_NSLOTS];
+        f->slotmem = io61_pool_get(IO61_NSLOTS * IO61_SLOTSIZE);
+        for (int i = 0; i != IO61_NSLOTS; ++i) {
+            f->slots[i].buf = &f->slotmem[i * IO61_SLOTSIZE];
+        }
+    } else {
+        f->wbuf = io61_pool_get(io61_bufmax);
+        if (f->shared) {
+            // io61_write doesn't grow a shared buffer, so use all of it
+            f->wsize = io61_bufmax;
+        }
+    }
+    return f;
+}
+
+
+// io61_close(f)
+//    Close the io61_file `f` and release all its resources.
+
+int io61_close(io61_file* f) {
+    io61_flush(f);
+    if (f->wbuf) {
+        io61_my->write_bufsize = std::max(io61_my->write_bufsize,
+                                          (unsigned long long) f->wsize);
+    } else if (f->slots) {
+        io61_my->read_bufsize = std::max(io61_my->read_bufsize,
+                                         (unsigned long long) f->rsize);
+    }
+    if (f->partner) {
+        f->partner->partner = nullptr;
+    }
+    if (f->async) {
+        if (f->compressed) {
+            f->wbuf = nullptr;  // belongs to the helper's ring
+        }
+        io61_async_stop(f);
+    }
+    if (f->map && f->wbuf == f->map) {
+        f->wbuf = nullptr;
+    }
+    if (f->dbuf) {
+        ++io61_my->direct_files;
+        if (io61_profiling) {
+            io61_my->cached_bytes += io61_resident(f);
+        }
+        io61_pool_put(f->dbuf, IO61_DIRECT_BUFSIZE);
+        if (f->wbuf == f->dbuf) {
+            f->wbuf = nullptr;
+        }
+    }
+    int r = close(f->fd);
+    if (f->map) {
+        munmap(f->map, f->mapsize);
+        ++io61_my->mmap_calls;
+    }
+    delete[] f->slots;
+    io61_pool_put(f->slotmem, IO61_NSLOTS * IO61_SLOTSIZE);
+    io61_pool_put(f->wbuf, io61_bufmax);
+    delete f;
+    return r;
+}
+
+
+// io61_pair(inf, outf)
+//    Pair a read-only pipe or socket `inf` with a write-only pipe or
+//    socket `outf` that carries requests to the same peer. Both file
+//    descriptors become non-blocking. Buffered output on `outf` is
+//    flushed before any read on `inf` would block, and whenever it is
+//    older than IO61_NAGLE_NS; while a write to `outf` is blocked,
+//    arriving input is saved in `inf`'s backlog, so two peers that both
+//    write before reading can't deadlock. Returns 0 on success and -1
+//    on error.
+
+int io61_pair(io61_file* inf, io61_file* outf) {
+    if (inf->seekable || outf->seekable || inf->async || inf->map
+        || outf->compressed
+        || (inf->mode & O_ACCMODE) != O_RDONLY
+        || (outf->mode & O_ACCMODE) != O_WRONLY) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (io61_file* f : {inf, outf}) {
+        int fl = fcntl(f->fd, F_GETFL);
+        if (fl == -1 || fcntl(f->fd, F_SETFL, fl | O_NONBLOCK) == -1) {
+            return -1;
+        }
+    }
+    inf->partner = outf;
+    outf->partner = inf;
+    return 0;
+}
+
+
+// io61_wait(f, events)
+//    Block until `f`'s file descriptor is ready for `events` (POLLIN or
+//    POLLOUT). While waiting to write, input that arrives for `f`'s
+//    partner is appended to the partner's backlog. Returns 0 when `f` is
+//    ready and -1 on error.
+
+static int io61_wait(io61_file* f, short events) {
+    io61_file* in = (events & POLLOUT) ? f->partner : nullptr;
+    struct pollfd pfd[2] = {{f->fd, events, 0}, {in ? in->fd : -1, POLLIN, 0}};
+    while (true) {
+        int r = poll(pfd, 2, -1);
+        if (r == -1 && errno != EINTR) {
+            return -1;
+        } else if (r <= 0) {
+            continue;
+        } else if (pfd[0].revents) {
+            return 0;
+        }
+        size_t n = in->backlog.size();
+        in->backlog.resize(n + IO61_SLOTSIZE);
+        uint64_t t0 = io61_clock_start();
+        ssize_t nr = read(in->fd, in->backlog.data() + n, IO61_SLOTSIZE);
+        io61_count_read(nr, t0);
+        in->backlog.resize(n + std::max(nr, (ssize_t) 0));
+        if (nr == 0 || (nr == -1 && errno != EINTR && errno != EAGAIN)) {
+            pfd[1].fd = -1;     // let the reader see EOF or the error
+        }
+    }
+}
+
+
+// io61_wait_input(f)
+//    Wait for input after a read from `f` failed with EAGAIN. The peer
+//    may be waiting for our buffered requests, so those are flushed
+//    first. Returns 0 on success and -1 on error.
+
+static int io61_wait_input(io61_file* f) {
+    if (f->partner && f->partner->wpos != 0) {
+        return io61_flush(f->partner);
+    }
+    return io61_wait(f, POLLIN);
+}
+
+
+// io61_sysread(f, off, buf, sz)
+//    Read up to `sz` bytes at file offset `off` directly from the file
+//    descriptor, retrying after signals and short reads. Returns the
+//    number of bytes read, or -1 if an error occurred before any bytes
+//    were read.
+
+static ssize_t io61_sysread(io61_file* f, off_t off, unsigned char* buf,
+                            size_t sz) {
+    if (f->seekable && f->fdpos != off) {
+        ++io61_my->seek_calls;
+        if (lseek(f->fd, off, SEEK_SET) == (off_t) -1) {
+            return -1;
+        }
+        f->fdpos = off;
+    }
+    size_t n = 0;
+    while (n != sz) {
+        if (f->backpos != f->backlog.size()) {
+            // input saved while a paired write was blocked
+            n = std::min(sz, f->backlog.size() - f->backpos);
+            io61_memcpy(buf, f->backlog.data() + f->backpos, n);
+            f->backpos += n;
+            f->fdpos += n;
+            if (f->backpos == f->backlog.size()) {
+                f->backlog.clear();
+                f->backpos = 0;
+            }
+            break;
+        }
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = read(f->fd, buf + n, sz - n);
+        io61_count_read(r, t0);
+        if (r > 0) {
+            n += r;
+            f->fdpos += r;
+            if (!f->seekable) {
+                break;          // don't wait for more pipe data
+            }
+        } else if (r == 0) {
+            break;
+        } else if (errno == EAGAIN) {
+            if (io61_wait_input(f) < 0) {
+                return n ? (ssize_t) n : -1;
+            }
+        } else if (errno != EINTR) {
+            return n ? (ssize_t) n : -1;
+        }
+    }
+    return n;
+}
+
+
+// io61_slot_lookup(f, off)
+//    Return the index of the cache slot holding offset `off`, or -1.
+
+static inline size_t io61_bucket(off_t off) {
+    return (size_t) (off / IO61_SLOTSIZE) & (io61_nbuckets - 1);
+}
+
+static int io61_slot_lookup(io61_file* f, off_t off) {
+    int i = f->buckets[io61_bucket(off)];
+    while (i >= 0 && f->slots[i].off != off) {
+        i = f->slots[i].next;
+    }
+    return i;
+}
+
+
+// io61_slot_evict(f)
+//    Choose an empty or least-recently-referenced slot using the CLOCK
+//    algorithm, remove it from the hash index, and return its index.
+//    The slot is marked referenced so that a multi-slot load can't
+//    choose it twice.
+
+static int io61_slot_evict(io61_file* f) {
+    while (f->slots[f->hand].referenced) {
+        f->slots[f->hand].referenced = false;
+        f->hand = (f->hand + 1) % IO61_NSLOTS;
+    }
+    int i = f->hand;
+    f->hand = (f->hand + 1) % IO61_NSLOTS;
+
+    io61_slot* s = &f->slots[i];
+    if (s->off >= 0) {
+        int* pp = &f->buckets[io61_bucket(s->off)];
+        while (*pp != i) {
+            pp = &f->slots[*pp].next;
+        }
+        *pp = s->next;
+    }
+    s->off = -1;
+    s->len = 0;
+    s->next = -1;
+    s->referenced = true;
+    return i;
+}
+
+
+// io61_observe(f, jump)
+//    Record that the file position of `f` moved by `jump` bytes between
+//    accesses (0 means a read picked up where the last one ended). Two
+//    equal jumps in a row establish a pattern; four unequal jumps in a
+//    row mean random access. Mapped files pass the pattern on to the
+//    kernel with madvise().
+
+static void io61_observe(io61_file* f, off_t jump) {
+    if (jump == f->last_jump) {
+        ++f->streak;
+        f->scattered = 0;
+    } else {
+        f->last_jump = jump;
+        f->streak = 1;
+        ++f->scattered;
+    }
+    if (f->streak >= 2) {
+        if (jump == 0) {
+            f->pattern = io61_pattern_sequential;
+        } else if (jump < 0) {
+            f->pattern = io61_pattern_reverse;
+        } else {
+            f->pattern = io61_pattern_strided;
+        }
+    } else if (f->scattered >= 4) {
+        f->pattern = io61_pattern_random;
+    }
+
+    if (f->map && f->pattern != f->advised) {
+        int advice = MADV_NORMAL;
+        if (f->pattern == io61_pattern_sequential) {
+            advice = MADV_SEQUENTIAL;
+        } else if (f->pattern == io61_pattern_reverse
+                   || f->pattern == io61_pattern_random
+                   || (f->pattern == io61_pattern_strided
+                       && f->last_jump >= IO61_SLOTSIZE)) {
+            advice = MADV_RANDOM;
+        }
+        madvise(f->map, f->mapsize, advice);
+        ++io61_my->mmap_calls;
+        f->advised = f->pattern;
+    }
+}
+
+
+// io61_iov_advance(iop, niov, n)
+//    Skip the first `n` bytes of the `niov`-element iovec array `iop`,
+//    adjusting `iop`, `niov`, and the partially consumed element.
+
+static void io61_iov_advance(struct iovec*& iop, int& niov, size_t n) {
+    while (niov && n >= iop->iov_len) {
+        n -= iop->iov_len;
+        ++iop;
+        --niov;
+    }
+    if (n) {
+        iop->iov_base = (char*) iop->iov_base + n;
+        iop->iov_len -= n;
+    }
+}
+
+
+// io61_iov_split(f, iov, iovcnt, max, fn)
+//    Call `fn` on consecutive pieces of at most `max` elements of the
+//    `iovcnt`-element iovec array `iov`, stopping after a short
+//    transfer. Returns the total, or -1 if the first piece failed.
+
+static ssize_t io61_iov_split(io61_file* f, const struct iovec* iov,
+                              int iovcnt, int max,
+                              ssize_t (*fn)(io61_file*, const struct iovec*,
+                                            int)) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i += max) {
+        int n = std::min(iovcnt - i, max);
+        size_t want = 0;
+        for (int j = i; j != i + n; ++j) {
+            want += iov[j].iov_len;
+        }
+        ssize_t r = fn(f, iov + i, n);
+        if (r < 0) {
+            return total ? total : -1;
+        }
+        total += r;
+        if ((size_t) r != want) {
+            break;
+        }
+    }
+    return total;
+}
+
+
+// io61_load(f, first, n)
+//    Read the `n` consecutive pages starting at file offset `first`
+//    into free cache slots with a single system call. Returns the number
+//    of bytes read or -1 on error.
+
+static ssize_t io61_load(io61_file* f, off_t first, int n) {
+    int idx[IO61_READAHEAD];
+    struct iovec iov[IO61_READAHEAD];
+    for (int j = 0; j != n; ++j) {
+        idx[j] = io61_slot_evict(f);
+        iov[j].iov_base = f->slots[idx[j]].buf;
+        iov[j].iov_len = IO61_SLOTSIZE;
+    }
+
+    if (f->fdpos != first) {
+        ++io61_my->seek_calls;
+        if (lseek(f->fd, first, SEEK_SET) == (off_t) -1) {
+            return -1;
+        }
+        f->fdpos = first;
+    }
+    size_t want = n * IO61_SLOTSIZE, total = 0;
+    struct iovec* iop = iov;
+    int niov = n;
+    while (total != want) {
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = readv(f->fd, iop, niov);
+        io61_count_read(r, t0);
+        if (r == 0) {
+            break;
+        } else if (r < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+        total += r;
+        f->fdpos += r;
+        io61_iov_advance(iop, niov, r);
+    }
+
+    for (int j = 0; j != n; ++j) {
+        io61_slot* s = &f->slots[idx[j]];
+        size_t start = j * IO61_SLOTSIZE;
+        if (start >= total && j != 0) {
+            break;              // past end of file; leave slot free
+        }
+        s->off = first + start;
+        s->len = std::min(total - std::min(total, start), (size_t) IO61_SLOTSIZE);
+        int* bucket = &f->buckets[io61_bucket(s->off)];
+        s->next = *bucket;
+        *bucket = idx[j];
+    }
+    return total;
+}
+
+
+// io61_fill(f)
+//    Point the read window at the cache slot containing the current
+//    file position, reading it from the file if necessary. Returns the
+//    number of bytes available at the file position (0 at end of file)
+//    or -1 on error.
+//
+//    On a miss, the detected access pattern decides what else to load:
+//    sequential readers get the following pages, reverse readers the
+//    preceding pages, and strided readers a kernel readahead hint for
+//    the next stride.
+
+static ssize_t io61_fill(io61_file* f) {
+    off_t pos = f->rtag + f->rpos;
+    if (f->rbuf && f->rpos == f->rend) {
+        io61_observe(f, 0);
+    }
+
+    if (f->async) {
+        return io61_async_fill(f, pos);
+    }
+
+    if (f->map) {
+        // The mapping covers the whole file; the window just moved off it.
+        f->rbuf = f->map;
+        f->rtag = 0;
+        f->rpos = pos;
+        f->rend = f->mapsize;
+        return pos < (off_t) f->mapsize ? f->mapsize - pos : 0;
+    }
+
+    if (f->dbuf) {
+        // O_DIRECT reads whole aligned blocks. If the kernel still
+        // refuses, read through the page cache instead.
+        off_t off = pos - (pos % IO61_DIRECT_ALIGN);
+        ssize_t n;
+        do {
+            uint64_t t0 = io61_clock_start();
+            n = pread(f->fd, f->dbuf, IO61_DIRECT_BUFSIZE, off);
+            io61_count_read(n, t0);
+            if (n == -1 && errno == EINVAL && f->direct
+                && io61_set_direct(f, false) == 0) {
+                errno = EINTR;
+            }
+        } while (n == -1 && errno == EINTR);
+        if (n < 0) {
+            return -1;
+        }
+        f->rbuf = f->dbuf;
+        f->rtag = off;
+        f->rpos = pos - off;
+        f->rend = n;
+        return f->rpos < f->rend ? f->rend - f->rpos : 0;
+    }
+
+    if (!f->seekable) {
+        // Pipes can't revisit old data, so the slot memory acts as one
+        // plain buffer. A read that fills it suggests a fast writer, so
+        // the next read asks for more.
+        io61_slot* s = &f->slots[0];
+        ssize_t n = io61_sysread(f, pos, s->buf, f->rsize);
+        if (n < 0) {
+            return -1;
+        } else if ((size_t) n == f->rsize && f->rsize < io61_bufmax) {
+            f->rsize *= 2;
+        }
+        s->off = pos;
+        s->len = n;
+        f->rbuf = s->buf;
+        f->rtag = pos;
+        f->rpos = 0;
+        f->rend = n;
+        return n;
+    }
+
+    off_t off = pos - (pos % IO61_SLOTSIZE);
+    int i = io61_slot_lookup(f, off);
+    if (i >= 0) {
+        ++io61_my->cache_hits;
+    } else {
+        io61_timer timer(io61_lat_miss);
+        ++io61_my->cache_misses;
+        off_t first = off;
+        int n = 1, nmax = f->rsize / IO61_SLOTSIZE;
+        if (f->pattern == io61_pattern_sequential) {
+            while (n != nmax
+                   && io61_slot_lookup(f, off + n * IO61_SLOTSIZE) < 0) {
+                ++n;
+            }
+            f->rsize = std::min(2 * f->rsize, io61_bufmax);
+        } else if (f->pattern == io61_pattern_random) {
+            f->rsize = IO61_SLOTSIZE;
+        } else if (f->pattern == io61_pattern_reverse) {
+            while (n != nmax && first != 0
+                   && io61_slot_lookup(f, first - IO61_SLOTSIZE) < 0) {
+                first -= IO61_SLOTSIZE;
+                ++n;
+            }
+            f->rsize = std::min(2 * f->rsize, io61_bufmax);
+        } else if (f->pattern == io61_pattern_strided
+                   && f->last_jump >= IO61_SLOTSIZE) {
+            off_t next = pos + f->last_jump;
+            posix_fadvise(f->fd, next - (next % IO61_SLOTSIZE),
+                          IO61_SLOTSIZE, POSIX_FADV_WILLNEED);
+        }
+        if (io61_load(f, first, n) < 0) {
+            return -1;
+        }
+        i = io61_slot_lookup(f, off);
+        assert(i >= 0);
+    }
+
+    io61_slot* s = &f->slots[i];
+    s->referenced = true;
+    f->rbuf = s->buf;
+    f->rtag = off;
+    f->rpos = pos - off;
+    f->rend = s->len;
+    return f->rpos < f->rend ? f->rend - f->rpos : 0;
+}
+
+
+// io61_readc(f)
+//    Read a single (unsigned) character from `f` and return it. Returns EOF
+//    (which is -1) on error or end-of-file.
+
+int io61_readc(io61_file* f) {
+    if (f->rpos >= f->rend && io61_fill(f) <= 0) {
+        return EOF;
+    }
+    return f->rbuf[f->rpos++];
+}
+
+
+// io61_read(f, buf, sz)
+//    Read up to `sz` characters from `f` into `buf`. Returns the number of
+//    characters read on success; normally this is `sz`. Returns a short
+//    count, which might be zero, if the file ended before `sz` characters
+//    could be read. Returns -1 if an error occurred before any characters
+//    were read.
+
+ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
+    io61_timer timer(io61_lat_read);
+    size_t nread = 0;
+    while (nread != sz) {
+        if (f->rpos >= f->rend && sz - nread >= f->rsize && f->slots) {
+            // Large request: read straight into the caller's buffer.
+            off_t pos = f->rtag + f->rpos;
+            ssize_t r = io61_sysread(f, pos, (unsigned char*) buf + nread,
+                                     sz - nread);
+            if (r < 0) {
+                return nread ? (ssize_t) nread : -1;
+            }
+            f->rbuf = nullptr;
+            f->rtag = pos + r;
+            f->rpos = f->rend = 0;
+            nread += r;
+            if (r == 0 || f->seekable) {
+                break;
+            }
+            continue;
+        }
+        if (f->rpos >= f->rend) {
+            ssize_t r = io61_fill(f);
+            if (r == 0) {
+                break;
+            } else if (r < 0) {
+                return nread ? (ssize_t) nread : -1;
+            }
+        }
+        size_t n = std::min(sz - nread, f->rend - f->rpos);
+        io61_memcpy(buf + nread, f->rbuf + f->rpos, n);
+        f->rpos += n;
+        nread += n;
+    }
+    return nread;
+}
+
+
+// io61_read_backwards(f, buf, sz)
+//    Read up to `sz` characters that precede `f`'s file position, in
+//    decreasing file order: `buf[0]` gets the character just before the
+//    position. Moves the file position back past the characters read.
+//    Returns the number of characters read, which is short only at the
+//    start of the file, or -1 if an error occurred before any characters
+//    were read.
+
+ssize_t io61_read_backwards(io61_file* f, char* buf, size_t sz) {
+    if (f->rpos >= sz && f->rpos <= f->rend && f->rbuf
+        && f->seekable && !f->compressed) {
+        // the read window holds all `sz` characters
+        io61_memrcpy(buf, f->rbuf + f->rpos - sz, sz);
+        f->rpos -= sz;
+        return sz;
+    }
+    if (!f->seekable || f->compressed || f->mode != O_RDONLY) {
+        errno = ESPIPE;
+        return -1;
+    }
+    off_t pos = f->rtag + f->rpos;
+    size_t nread = 0;
+    while (nread != sz && pos != 0) {
+        if (f->rbuf && pos > f->rtag && pos <= f->rtag + (off_t) f->rend) {
+            size_t n = std::min(sz - nread, (size_t) (pos - f->rtag));
+            io61_memrcpy(buf + nread, f->rbuf + (pos - f->rtag) - n, n);
+            pos -= n;
+            nread += n;
+            continue;
+        }
+        // Load a window that ends at `pos`. The page cache reads the
+        // preceding pages too once it knows the pattern.
+        size_t back = 1;
+        if (f->dbuf) {
+            back = IO61_DIRECT_BUFSIZE - IO61_DIRECT_ALIGN;
+        } else if (f->async) {
+            back = IO61_ASYNC_BUFSIZE - IO61_SLOTSIZE;
+        }
+        f->pattern = io61_pattern_reverse;
+        f->rbuf = nullptr;
+        f->rtag = pos - std::min(pos, (off_t) back);
+        f->rpos = f->rend = 0;
+        if (io61_fill(f) < 0) {
+            return nread ? (ssize_t) nread : -1;
+        }
+        if (f->async && f->rend != 0 && f->rtag + (off_t) f->rend < pos) {
+            // A read-ahead buffer that holds `rtag` can end before `pos`;
+            // the next one continues it.
+            f->rpos = f->rend;
+            if (io61_fill(f) < 0) {
+                return nread ? (ssize_t) nread : -1;
+            }
+        }
+        if (f->rtag + (off_t) f->rend < pos) {
+            off_t size = io61_filesize(f);
+            if (size < 0 || pos > size) {
+                break;          // `pos` is past end of file
+            }
+            errno = EIO;        // a short window in the middle of the file
+            return nread ? (ssize_t) nread : -1;
+        }
+    }
+    if (f->rbuf && pos >= f->rtag && pos <= f->rtag + (off_t) f->rend) {
+        f->rpos = pos - f->rtag;
+    } else {
+        f->rbuf = nullptr;
+        f->rtag = pos;
+        f->rpos = f->rend = 0;
+    }
+    return nread;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Read characters from `f` into `buf` up to and including the next
+//    newline, stopping early after `sz` characters or at end of file.
+//    Returns the number of characters read, 0 at end of file, or -1 if
+//    an error occurred before any characters were read.
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        if (f->rpos >= f->rend) {
+            ssize_t r = io61_fill(f);
+            if (r == 0) {
+                break;
+            } else if (r < 0) {
+                return nread ? (ssize_t) nread : -1;
+            }
+        }
+        // memchr scans the whole cached run a word (or vector) at a time
+        size_t n = std::min(sz - nread, f->rend - f->rpos);
+        const unsigned char* p = f->rbuf + f->rpos;
+        const void* nl = memchr(p, '\n', n);
+        if (nl) {
+            n = (const unsigned char*) nl - p + 1;
+        }
+        io61_memcpy(buf + nread, p, n);
+        f->rpos += n;
+        nread += n;
+        if (nl) {
+            break;
+        }
+    }
+    return nread;
+}
+
+
+// io61_pread(f, buf, sz, off)
+//    Read up to `sz` characters at file offset `off` into `buf` without
+//    using or changing `f`'s file position, so many threads may call it
+//    on the same file at once. Returns the number of characters read,
+//    which is short only at end of file, or -1 on error. On an
+//    IO61_DIRECT file, `buf`, `sz`, and `off` must be aligned.
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    if (f->compressed || !f->seekable) {
+        errno = ESPIPE;
+        return -1;
+    }
+    if (f->map) {
+        if (off < 0 || (size_t) off >= f->mapsize) {
+            return 0;
+        }
+        size_t n = std::min(sz, f->mapsize - off);
+        io61_memcpy(buf, f->map + off, n);
+        return n;
+    }
+    size_t n = 0;
+    while (n != sz) {
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = pread(f->fd, buf + n, sz - n, off + n);
+        io61_count_read(r, t0);
+        if (r > 0) {
+            n += r;
+        } else if (r == 0) {
+            break;
+        } else if (errno == EAGAIN) {
+            if (io61_wait(f, POLLIN) < 0) {
+                return n ? (ssize_t) n : -1;
+            }
+        } else if (errno != EINTR) {
+            return n ? (ssize_t) n : -1;
+        }
+    }
+    return n;
+}
+
+
+// io61_prefetch(f, offs, n, blocksize)
+//    Tell read-only file `f` that the caller will soon read the `n`
+//    blocks of `blocksize` bytes starting at offsets `offs[0..n)`, in
+//    any order. The blocks are sorted and merged into runs, and the
+//    kernel starts reading each run into the page cache in the
+//    background, so later io61_seek and io61_read calls find the data
+//    ready. Files that don't use the page cache ignore the hint.
+//    Returns 0 on success and -1 on error.
+
+int io61_prefetch(io61_file* f, const off_t* offs, size_t n,
+                  size_t blocksize) {
+    if (f->mode != O_RDONLY) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!f->seekable || f->compressed || f->async || f->dbuf
+        || n == 0 || blocksize == 0) {
+        return 0;
+    }
+    std::vector<off_t> sorted(offs, offs + n);
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t i = 0;
+    while (i != n) {
+        // Page-aligned run covering this block and any that follow it
+        // closely. Reading a short gap costs less than another system
+        // call, and sequential readahead would read it anyway.
+        off_t lo = sorted[i] - (sorted[i] % IO61_SLOTSIZE);
+        off_t hi = sorted[i] + blocksize;
+        for (++i; i != n && sorted[i] <= hi + (off_t) io61_bufmax; ++i) {
+            hi = std::max(hi, (off_t) (sorted[i] + blocksize));
+        }
+        int r;
+        if (f->map) {
+            if (lo < 0 || (size_t) lo >= f->mapsize) {
+                continue;
+            }
+            hi = std::min(hi, (off_t) f->mapsize);
+            r = madvise(f->map + lo, hi - lo, MADV_WILLNEED);
+            ++io61_my->mmap_calls;
+        } else if ((r = posix_fadvise(f->fd, std::max(lo, (off_t) 0), hi - lo,
+                                      POSIX_FADV_WILLNEED)) != 0) {
+            errno = r;
+            r = -1;
+        }
+        if (r == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// io61_peek(f, ptr, len)
+//    Expose the data at `f`'s file position without copying it: sets
+//    `*ptr` to the cached bytes and `*len` to their number, which is 0
+//    at end of file. The bytes stay valid until the next operation on
+//    `f` other than io61_consume. Returns 0 on success and -1 on error.
+
+int io61_peek(io61_file* f, const char** ptr, size_t* len) {
+    if (f->rpos >= f->rend && io61_fill(f) < 0) {
+        return -1;
+    }
+    *ptr = (const char*) f->rbuf + f->rpos;
+    *len = f->rpos < f->rend ? f->rend - f->rpos : 0;
+    return 0;
+}
+
+
+// io61_consume(f, n)
+//    Advance `f`'s file position past `n` bytes returned by io61_peek.
+//    Returns 0 on success and -1 if fewer than `n` bytes were exposed.
+
+int io61_consume(io61_file* f, size_t n) {
+    if (f->rpos + n > f->rend) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->rpos += n;
+    return 0;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+//    Read into the `iovcnt` buffers described by `iov`, in order. Cached
+//    data is copied first; a large uncached remainder is read with a
+//    single readv system call (or several, for more than IOV_MAX
+//    buffers). Returns the number of bytes read, which is short only at
+//    end of file, or -1 if an error occurred before any bytes were read.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    struct iovec local[IOV_MAX];
+    if (iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    } else if (iovcnt > IOV_MAX) {
+        return io61_iov_split(f, iov, iovcnt, IOV_MAX, io61_readv);
+    }
+    memcpy(local, iov, iovcnt * sizeof(struct iovec));
+    struct iovec* iop = local;
+    int niov = iovcnt;
+    size_t nread = 0;
+
+    // drain the read window
+    while (niov && f->rpos < f->rend) {
+        size_t n = std::min(iop->iov_len, f->rend - f->rpos);
+        io61_memcpy(iop->iov_base, f->rbuf + f->rpos, n);
+        f->rpos += n;
+        nread += n;
+        io61_iov_advance(iop, niov, n);
+    }
+
+    // then input saved while a paired write was blocked
+    off_t pos = f->rtag + f->rpos;
+    if (niov && f->backpos != f->backlog.size()) {
+        while (niov && f->backpos != f->backlog.size()) {
+            size_t n = std::min(iop->iov_len, f->backlog.size() - f->backpos);
+            io61_memcpy(iop->iov_base, f->backlog.data() + f->backpos, n);
+            f->backpos += n;
+            f->fdpos += n;
+            pos += n;
+            nread += n;
+            io61_iov_advance(iop, niov, n);
+        }
+        if (f->backpos == f->backlog.size()) {
+            f->backlog.clear();
+            f->backpos = 0;
+        }
+        f->rbuf = nullptr;
+        f->rtag = pos;
+        f->rpos = f->rend = 0;
+    }
+
+    size_t rest = 0;
+    for (int i = 0; i != niov; ++i) {
+        rest += iop[i].iov_len;
+    }
+    if (f->map || f->async || f->dbuf || rest < f->rsize) {
+        // small remainder: go through the cache
+        for (; niov; ++iop, --niov) {
+            ssize_t r = io61_read(f, (char*) iop->iov_base, iop->iov_len);
+            if (r < 0) {
+                return nread ? (ssize_t) nread : -1;
+            }
+            nread += r;
+            if ((size_t) r != iop->iov_len) {
+                break;
+            }
+        }
+        return nread;
+    }
+
+    if (f->seekable && f->fdpos != pos) {
+        ++io61_my->seek_calls;
+        if (lseek(f->fd, pos, SEEK_SET) == (off_t) -1) {
+            return nread ? (ssize_t) nread : -1;
+        }
+        f->fdpos = pos;
+    }
+    while (niov) {
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = readv(f->fd, iop, niov);
+        io61_count_read(r, t0);
+        if (r == 0) {
+            break;
+        } else if (r < 0) {
+            if (errno == EAGAIN && nread != 0 && !f->seekable) {
+                break;          // don't wait for more pipe data
+            } else if (errno == EINTR
+                       || (errno == EAGAIN && io61_wait_input(f) == 0)) {
+                continue;
+            }
+            if (nread == 0) {
+                return -1;
+            }
+            break;
+        }
+        nread += r;
+        pos += r;
+        f->fdpos += r;
+        io61_iov_advance(iop, niov, r);
+    }
+    f->rbuf = nullptr;
+    f->rtag = pos;
+    f->rpos = f->rend = 0;
+    return nread;
+}
+
+
+// io61_syswrite(f, off, buf, sz)
+//    Write `sz` bytes at file offset `off` directly to the file
+//    descriptor, retrying after signals and short writes. Returns the
+//    number of bytes written, or -1 if an error occurred before any bytes
+//    were written.
+
+static ssize_t io61_syswrite(io61_file* f, off_t off, const unsigned char* buf,
+                             size_t sz) {
+    if (f->seekable && f->fdpos != off) {
+        ++io61_my->seek_calls;
+        if (lseek(f->fd, off, SEEK_SET) == (off_t) -1) {
+            return -1;
+        }
+        f->fdpos = off;
+    }
+    size_t n = 0;
+    while (n != sz) {
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = write(f->fd, buf + n, sz - n);
+        io61_count_write(r, t0);
+        if (r > 0) {
+            n += r;
+            f->fdpos += r;
+        } else if (r == -1 && errno == EAGAIN) {
+            if (io61_wait(f, POLLOUT) < 0) {
+                return n ? (ssize_t) n : -1;
+            }
+        } else if (r == -1 && errno != EINTR) {
+            return n ? (ssize_t) n : -1;
+        }
+    }
+    return n;
+}
 
-struct io61_file {
-    int fd;
-};
 
+// io61_mark(blk, lo, hi)
+//    Mark bytes `[lo, hi)` of dirty block `blk` as written.
 
-// io61_fdopen(fd, mode)
-//    Return a new io61_file for file descriptor `fd`. `mode` is
-//    either O_RDONLY for a read-only file or O_WRONLY for a
-//    write-only file. You need not support read/write files.
+static void io61_mark(io61_dirty* blk, size_t lo, size_t hi) {
+    while (lo != hi) {
+        size_t w = lo / 64, b = lo % 64;
+        size_t n = std::min(hi - lo, 64 - b);
+        uint64_t bits = (n == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1) << b;
+        blk->nvalid += __builtin_popcountll(bits & ~blk->valid[w]);
+        blk->valid[w] |= bits;
+        lo += n;
+    }
+}
 
-io61_file* io61_fdopen(int fd, int mode) {
-    assert(fd >= 0);
-    io61_file* f = new io61_file;
-    f->fd = fd;
-    (void) mode;
-    return f;
+
+// io61_stash(f)
+//    Move the contents of `f`'s write buffer into its dirty blocks.
+//    Newer data replaces older data at the same offsets.
+
+static void io61_stash(io61_file* f) {
+    off_t off = f->wtag;
+    size_t pos = 0;
+    while (pos != f->wpos) {
+        off_t tag = off - off % IO61_SLOTSIZE;
+        size_t lo = off - tag;
+        size_t n = std::min(f->wpos - pos, IO61_SLOTSIZE - lo);
+        std::unique_ptr<io61_dirty>& blk = f->dirty[tag];
+        if (!blk) {
+            blk.reset(new io61_dirty);
+            f->ndirty += IO61_SLOTSIZE;
+        }
+        io61_memcpy(blk->buf + lo, f->wbuf + pos, n);
+        io61_mark(blk.get(), lo, lo + n);
+        off += n;
+        pos += n;
+    }
+    f->wtag = off;
+    f->wpos = 0;
 }
 
 
-// io61_close(f)
-//    Close the io61_file `f` and release all its resources.
+// io61_pwritev(f, iov, iovcnt, off)
+//    Write all of `iov` at offset `off`. Returns 0 on success and -1 on
+//    error; a write that makes no progress fails with EIO.
 
-int io61_close(io61_file* f) {
-    io61_flush(f);
-    int r = close(f->fd);
-    delete f;
+static int io61_pwritev(io61_file* f, struct iovec* iov, int iovcnt,
+                        off_t off) {
+    while (iovcnt != 0) {
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = pwritev(f->fd, iov, iovcnt, off);
+        io61_count_write(r, t0);
+        if (r > 0) {
+            off += r;
+            io61_iov_advance(iov, iovcnt, r);
+        } else if (r == 0) {
+            errno = EIO;
+            return -1;
+        } else if (errno == EAGAIN) {
+            if (io61_wait(f, POLLOUT) < 0) {
+                return -1;
+            }
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// io61_drain_direct(f, all)
+//    Write `f`'s buffered data with O_DIRECT. Bytes before the first
+//    aligned file offset go through the page cache, and the rest moves
+//    to the front of the buffer; the aligned bulk is then written
+//    directly. An unaligned tail stays buffered unless `all` is true, in
+//    which case it too goes through the page cache. Returns 0 on
+//    success and -1 on error.
+
+static int io61_drain_direct(io61_file* f, bool all) {
+    size_t head = (IO61_DIRECT_ALIGN - f->wtag % IO61_DIRECT_ALIGN)
+        % IO61_DIRECT_ALIGN;
+    head = std::min(head, f->wpos);
+    if (head != 0) {
+        if (io61_set_direct(f, false) < 0
+            || io61_syswrite(f, f->wtag, f->wbuf, head) != (ssize_t) head) {
+            return -1;
+        }
+        memmove(f->wbuf, f->wbuf + head, f->wpos - head);
+        io61_my->bytes_copied += f->wpos - head;
+        f->wtag += head;
+        f->wpos -= head;
+    }
+
+    size_t bulk = f->wpos - f->wpos % IO61_DIRECT_ALIGN;
+    if (bulk != 0) {
+        io61_set_direct(f, true);
+        ssize_t r = io61_syswrite(f, f->wtag, f->wbuf, bulk);
+        if (r == -1 && errno == EINVAL && f->direct
+            && io61_set_direct(f, false) == 0) {
+            r = io61_syswrite(f, f->wtag, f->wbuf, bulk);
+        }
+        if (r != (ssize_t) bulk) {
+            return -1;
+        }
+        f->wtag += bulk;
+    }
+
+    size_t tail = f->wpos - bulk;
+    if (tail != 0 && all) {
+        if (io61_set_direct(f, false) < 0
+            || io61_syswrite(f, f->wtag, f->wbuf + bulk, tail)
+               != (ssize_t) tail) {
+            return -1;
+        }
+        f->wtag += tail;
+        tail = 0;
+    } else if (tail != 0 && bulk != 0) {
+        memmove(f->wbuf, f->wbuf + bulk, tail);
+        io61_my->bytes_copied += tail;
+    }
+    f->wpos = tail;
+    return 0;
+}
+
+
+// io61_zdrain(f)
+//    Hand `f`'s write buffer to the compression helper and wait for the
+//    next buffer to be free. Returns 0 on success and -1 if the helper
+//    has failed.
+
+static int io61_zdrain(io61_file* f) {
+    io61_async* a = f->async;
+    std::unique_lock<std::mutex> guard(a->m);
+    if (f->wpos != 0) {
+        a->len[a->head] = f->wpos;
+        a->full[a->head] = true;
+        a->head = (a->head + 1) % IO61_ASYNC_DEPTH;
+        a->cv.notify_all();
+        f->wtag += f->wpos;
+        f->wpos = 0;
+        a->cv.wait(guard, [a] { return !a->full[a->head]; });
+        f->wbuf = a->buf[a->head];
+    }
+    if (a->err) {
+        errno = a->err;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_unmap_output(f)
+//    Stop writing `f` through its output mapping, leaving the file
+//    position where it was; later data is buffered as usual. Returns 0
+//    on success and -1 on error.
+
+static int io61_unmap_output(io61_file* f) {
+    int r = msync(f->map, f->mapsize, MS_ASYNC);
+    munmap(f->map, f->mapsize);
+    io61_my->mmap_calls += 2;
+    f->wtag += f->wpos;
+    f->wpos = 0;
+    f->wsize = IO61_SLOTSIZE;
+    f->map = nullptr;
+    f->mapsize = 0;
+    f->wbuf = io61_pool_get(io61_bufmax);
     return r;
 }
 
 
-// io61_readc(f)
-//    Read a single (unsigned) character from `f` and return it. Returns EOF
-//    (which is -1) on error or end-of-file.
+// io61_drain(f)
+//    Empty `f`'s write buffer. While `f` has only been written
+//    sequentially, the data goes straight to the file; once it has
+//    seeked, the data joins the dirty extents, which are written back
+//    when they exceed IO61_DIRTY_MAX bytes. Returns 0 on success and -1
+//    on error.
 
-int io61_readc(io61_file* f) {
-    unsigned char buf[1];
-    if (read(f->fd, buf, 1) == 1) {
-        return buf[0];
-    } else {
-        return EOF;
+static int io61_drain(io61_file* f) {
+    if (f->wpos == 0) {
+        return 0;
+    } else if (f->map) {
+        // the output mapping is full
+        return io61_unmap_output(f);
+    } else if (f->compressed) {
+        return io61_zdrain(f);
+    } else if (f->dirty.empty() && f->dbuf) {
+        return io61_drain_direct(f, false);
+    } else if (f->dirty.empty()) {
+        ssize_t r = io61_syswrite(f, f->wtag, f->wbuf, f->wpos);
+        if (r != (ssize_t) f->wpos) {
+            return -1;
+        }
+        f->wtag += f->wpos;
+        f->wpos = 0;
+        return 0;
     }
+    io61_stash(f);
+    return f->ndirty > IO61_DIRTY_MAX ? io61_flush(f) : 0;
 }
 
 
-// io61_read(f, buf, sz)
-//    Read up to `sz` characters from `f` into `buf`. Returns the number of
-//    characters read on success; normally this is `sz`. Returns a short
-//    count, which might be zero, if the file ended before `sz` characters
-//    could be read. Returns -1 if an error occurred before any characters
-//    were read.
+// io61_nagle(f)
+//    Flush a paired writer whose buffered data has waited longer than
+//    IO61_NAGLE_NS. Called as more data is written; data left idle is
+//    flushed by the next read on the partner. Returns 0 on success and
+//    -1 on error.
 
-ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
-    size_t nread = 0;
-    while (nread != sz) {
-        int ch = io61_readc(f);
-        if (ch == EOF) {
-            break;
+static int io61_nagle(io61_file* f) {
+    uint64_t now = io61_clock();
+    if (f->wpos != 0 && now - f->wsince > IO61_NAGLE_NS
+        && io61_flush(f) < 0) {
+        return -1;
+    }
+    if (f->wpos == 0) {
+        f->wsince = now;
+    }
+    return 0;
+}
+
+
+// Shared writers (IO61_SHARED)
+//    Threads append to a shared writer under the spinlock `wlock`,
+//    which covers only copying into `wbuf` and reserving file offsets;
+//    no system call runs while it is held. A thread that needs the
+//    buffer emptied swaps in a fresh one, allocated before taking the
+//    lock, and writes the old one after releasing it. Seekable files
+//    write it with pwrite at its reserved offset. Pipes and sockets
+//    can't, so each swap also takes a ticket, and writes go out in
+//    ticket order.
+
+static void io61_spin_lock(io61_file* f) {
+    while (f->wlock.exchange(true, std::memory_order_acquire)) {
+        while (f->wlock.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
         }
-        buf[nread] = ch;
-        ++nread;
     }
-    return nread;
+}
+
+static void io61_spin_unlock(io61_file* f) {
+    f->wlock.store(false, std::memory_order_release);
+}
+
+// io61_shared_batch
+//    A write buffer detached from a shared writer: `len` bytes at file
+//    offset `tag`, written in turn `ticket`.
+
+struct io61_shared_batch {
+    unsigned char* buf;
+    off_t tag;
+    size_t len;
+    uint64_t ticket;
+};
+
+// io61_shared_swap(f, fresh, tag)
+//    With `wlock` held, detach `f`'s write buffer and install the empty
+//    buffer `fresh`, which starts at file offset `tag`.
+
+static io61_shared_batch io61_shared_swap(io61_file* f, unsigned char* fresh,
+                                          off_t tag) {
+    io61_shared_batch b = {f->wbuf, f->wtag, f->wpos, f->wticket++};
+    f->wbuf = fresh;
+    f->wtag = tag;
+    f->wpos = 0;
+    return b;
+}
+
+// io61_shared_put(f, b, buf, sz)
+//    Write batch `b` followed by `buf[0..sz)`, which is contiguous with
+//    it, then release `b`'s buffer. Called without `wlock`. Returns 0
+//    on success and -1 on error.
+
+static int io61_shared_put(io61_file* f, const io61_shared_batch& b,
+                           const char* buf, size_t sz) {
+    int r = 0;
+    if (f->seekable) {
+        struct iovec iov[2] = {{b.buf, b.len}, {const_cast<char*>(buf), sz}};
+        if (b.len + sz != 0) {
+            r = io61_pwritev(f, iov, 2, b.tag);
+        }
+    } else {
+        std::unique_lock<std::mutex> guard(f->wturnlock);
+        f->wturncv.wait(guard, [&] { return f->wturn == b.ticket; });
+        guard.unlock();
+        const unsigned char* ubuf = (const unsigned char*) buf;
+        if (io61_syswrite(f, b.tag, b.buf, b.len) != (ssize_t) b.len
+            || io61_syswrite(f, b.tag + b.len, ubuf, sz) != (ssize_t) sz) {
+            r = -1;
+        }
+        guard.lock();
+        ++f->wturn;
+        f->wturncv.notify_all();
+    }
+    io61_pool_put(b.buf, io61_bufmax);
+    return r;
+}
+
+// io61_write_shared(f, buf, sz)
+//    io61_write for IO61_SHARED files. Each call's data stays together.
+
+static ssize_t io61_write_shared(io61_file* f, const char* buf, size_t sz) {
+    io61_spin_lock(f);
+    if (f->wpos + sz <= f->wsize) {
+        io61_memcpy(f->wbuf + f->wpos, buf, sz);
+        f->wpos += sz;
+        io61_spin_unlock(f);
+        return sz;
+    }
+    io61_spin_unlock(f);
+
+    unsigned char* fresh = io61_pool_get(io61_bufmax);
+    io61_spin_lock(f);
+    if (f->wpos + sz <= f->wsize) {
+        // another thread emptied the buffer meanwhile
+        io61_memcpy(f->wbuf + f->wpos, buf, sz);
+        f->wpos += sz;
+        io61_spin_unlock(f);
+        io61_pool_put(fresh, io61_bufmax);
+        return sz;
+    }
+    // Reserve `[off, off + sz)`; large writes skip the buffer.
+    off_t off = f->wtag + f->wpos;
+    bool direct = sz >= f->wsize;
+    io61_shared_batch b = io61_shared_swap(f, fresh, direct ? off + sz : off);
+    if (!direct) {
+        io61_memcpy(f->wbuf, buf, sz);
+        f->wpos = sz;
+    }
+    io61_spin_unlock(f);
 
-    // Note: This function never returns -1 because `io61_readc`
-    // does not distinguish between error and end-of-file.
-    // Your final version should return -1 if a system call indicates
-    // an error.
+    int r = io61_shared_put(f, b, direct ? buf : nullptr, direct ? sz : 0);
+    return r == 0 ? (ssize_t) sz : -1;
+}
+
+// io61_flush_shared(f, tag)
+//    io61_flush for IO61_SHARED files: write the buffered data, and
+//    continue at file offset `tag`, or where the data ends if `tag < 0`.
+
+static int io61_flush_shared(io61_file* f, off_t tag) {
+    unsigned char* fresh = io61_pool_get(io61_bufmax);
+    io61_spin_lock(f);
+    io61_shared_batch b = io61_shared_swap(f, fresh,
+                                           tag < 0 ? f->wtag + f->wpos : tag);
+    io61_spin_unlock(f);
+    return io61_shared_put(f, b, nullptr, 0);
 }
 
 
@@ -86,13 +2184,18 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 //    -1 on error.
 
 int io61_writec(io61_file* f, int ch) {
-    unsigned char buf[1];
-    buf[0] = ch;
-    if (write(f->fd, buf, 1) == 1) {
-        return 0;
-    } else {
+    if (f->shared) {
+        char c = ch;
+        return io61_write_shared(f, &c, 1) == 1 ? 0 : -1;
+    }
+    if (f->wpos == f->wsize && io61_drain(f) < 0) {
+        return -1;
+    }
+    if (f->partner && io61_nagle(f) < 0) {
         return -1;
     }
+    f->wbuf[f->wpos++] = ch;
+    return 0;
 }
 
 
@@ -102,13 +2205,157 @@ int io61_writec(io61_file* f, int ch) {
 //    an error occurred before any characters were written.
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
+    io61_timer timer(io61_lat_write);
+    if (!f->shared && !f->partner && f->wpos + sz <= f->wsize) {
+        // fits in the buffer
+        io61_memcpy(f->wbuf + f->wpos, buf, sz);
+        f->wpos += sz;
+        return sz;
+    }
+    if (f->shared) {
+        return io61_write_shared(f, buf, sz);
+    }
+    if (f->partner && io61_nagle(f) < 0) {
+        return -1;
+    }
+    if (f->map) {
+        // fill the output mapping, then write the rest past its end
+        size_t n = f->wsize - f->wpos;
+        io61_memcpy(f->wbuf + f->wpos, buf, n);
+        f->wpos += n;
+        ssize_t r = -1;
+        if (io61_unmap_output(f) == 0) {
+            r = io61_write(f, buf + n, sz - n);
+        }
+        return r >= 0 ? (ssize_t) n + r : (n ? (ssize_t) n : -1);
+    }
+    // Large writes grow the buffer; writes larger than even that bypass
+    // it, going out together with the buffered data. A compressed
+    // writer's buffer is one fixed-size lz61 block.
+    while (!f->compressed && f->wsize < sz && f->wsize < io61_bufmax) {
+        f->wsize *= 2;
+    }
+    if (sz >= f->wsize && f->wpos + sz > f->wsize
+        && !f->dbuf && !f->compressed) {
+        struct iovec iov = {(void*) buf, sz};
+        return io61_writev(f, &iov, 1);
+    }
     size_t nwritten = 0;
     while (nwritten != sz) {
-        if (io61_writec(f, buf[nwritten]) == -1) {
+        if (f->wpos == f->wsize && io61_drain(f) < 0) {
+            break;
+        }
+        size_t n = std::min(sz - nwritten, f->wsize - f->wpos);
+        io61_memcpy(f->wbuf + f->wpos, buf + nwritten, n);
+        f->wpos += n;
+        nwritten += n;
+    }
+    if (nwritten != 0 || sz == 0) {
+        return nwritten;
+    } else {
+        return -1;
+    }
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Write the `iovcnt` buffers described by `iov`, in order. Small
+//    writes are buffered; otherwise any buffered data and all the
+//    buffers go out with a single writev system call. Longer vectors
+//    are written in pieces, since one writev element holds the buffered
+//    data. Returns the number of bytes written, or -1 if an error
+//    occurred before any bytes were written.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    if (iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    } else if (iovcnt > IOV_MAX - 1) {
+        return io61_iov_split(f, iov, iovcnt, IOV_MAX - 1, io61_writev);
+    }
+    if (f->shared) {
+        // each buffer is appended atomically, but not the whole vector
+        ssize_t nw = 0;
+        for (int i = 0; i != iovcnt; ++i) {
+            ssize_t r = io61_write_shared(f, (const char*) iov[i].iov_base,
+                                          iov[i].iov_len);
+            if (r < 0) {
+                return nw ? nw : -1;
+            }
+            nw += r;
+        }
+        return nw;
+    }
+    if (f->dbuf || f->compressed || f->map) {
+        // IO61_DIRECT and IO61_LZ61 data must pass through the buffer,
+        // and mapped output goes straight to the mapping
+        ssize_t nw = 0;
+        for (int i = 0; i != iovcnt; ++i) {
+            ssize_t r = io61_write(f, (const char*) iov[i].iov_base,
+                                   iov[i].iov_len);
+            if (r < 0) {
+                return nw ? nw : -1;
+            }
+            nw += r;
+        }
+        return nw;
+    }
+    if (f->partner && io61_nagle(f) < 0) {
+        return -1;
+    }
+    size_t sz = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        sz += iov[i].iov_len;
+    }
+    if (f->wpos + sz <= f->wsize) {
+        for (int i = 0; i != iovcnt; ++i) {
+            io61_memcpy(f->wbuf + f->wpos, iov[i].iov_base, iov[i].iov_len);
+            f->wpos += iov[i].iov_len;
+        }
+        return sz;
+    }
+
+    if (!f->dirty.empty() && io61_flush(f) < 0) {
+        return -1;
+    }
+    struct iovec local[IOV_MAX];
+    local[0].iov_base = f->wbuf;
+    local[0].iov_len = f->wpos;
+    memcpy(&local[1], iov, iovcnt * sizeof(struct iovec));
+    struct iovec* iop = local;
+    int niov = iovcnt + 1;
+    size_t want = f->wpos + sz, total = 0;
+
+    if (f->seekable && f->fdpos != f->wtag) {
+        ++io61_my->seek_calls;
+        if (lseek(f->fd, f->wtag, SEEK_SET) == (off_t) -1) {
+            return -1;
+        }
+        f->fdpos = f->wtag;
+    }
+    while (total != want) {
+        uint64_t t0 = io61_clock_start();
+        ssize_t r = writev(f->fd, iop, niov);
+        io61_count_write(r, t0);
+        if (r < 0) {
+            if (errno == EINTR
+                || (errno == EAGAIN && io61_wait(f, POLLOUT) == 0)) {
+                continue;
+            }
             break;
         }
-        ++nwritten;
+        total += r;
+        f->fdpos += r;
+        io61_iov_advance(iop, niov, r);
     }
+
+    // Account for what made it out; keep unwritten buffered bytes.
+    size_t fromwbuf = std::min(total, f->wpos);
+    memmove(f->wbuf, f->wbuf + fromwbuf, f->wpos - fromwbuf);
+    io61_my->bytes_copied += f->wpos - fromwbuf;
+    f->wpos -= fromwbuf;
+    f->wtag += total;
+    size_t nwritten = total - fromwbuf;
     if (nwritten != 0 || sz == 0) {
         return nwritten;
     } else {
@@ -117,13 +2364,178 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 }
 
 
+// io61_reserve(f, ptr, len)
+//    Expose free space in `f`'s write buffer: sets `*ptr` to it and
+//    `*len` to its size, which is never 0. Data placed there is written
+//    by io61_commit. Returns 0 on success and -1 on error.
+//
+//    The reserved space belongs to a single writer, so IO61_SHARED files
+//    refuse io61_reserve and io61_commit with EINVAL.
+
+int io61_reserve(io61_file* f, char** ptr, size_t* len) {
+    if (f->shared) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (f->wpos == f->wsize && io61_drain(f) < 0) {
+        return -1;
+    }
+    *ptr = (char*) f->wbuf + f->wpos;
+    *len = f->wsize - f->wpos;
+    return 0;
+}
+
+
+// io61_commit(f, n)
+//    Write the first `n` bytes of the space returned by io61_reserve.
+//    Returns 0 on success and -1 if `n` exceeds the reserved space or
+//    `f` is IO61_SHARED.
+
+int io61_commit(io61_file* f, size_t n) {
+    if (f->shared || f->wpos + n > f->wsize) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->wpos += n;
+    return 0;
+}
+
+
 // io61_flush(f)
 //    Forces a write of all buffered data written to `f`.
 //    If `f` was opened read-only, io61_flush(f) may either drop all
 //    data buffered for reading, or do nothing.
 
 int io61_flush(io61_file* f) {
-    (void) f;
+    io61_timer timer(io61_lat_flush);
+    if (f->mode == O_RDONLY) {
+        return 0;
+    } else if (f->map) {
+        // mapped data is already in the page cache
+        ++io61_my->mmap_calls;
+        return msync(f->map, f->mapsize, MS_ASYNC);
+    } else if (f->compressed) {
+        // wait for the helper to write every block
+        if (io61_zdrain(f) < 0) {
+            return -1;
+        }
+        io61_async* a = f->async;
+        std::unique_lock<std::mutex> guard(a->m);
+        a->cv.wait(guard, [a] { return a->tail == a->head; });
+        if (a->err) {
+            errno = a->err;
+            return -1;
+        }
+        return 0;
+    } else if (f->shared) {
+        return io61_flush_shared(f, -1);
+    } else if (f->dirty.empty()) {
+        return f->dbuf ? io61_drain_direct(f, true) : io61_drain(f);
+    }
+
+    // Write dirty bytes back in file order, gathering each run of
+    // consecutive bytes into one pwritev.
+    io61_stash(f);
+    if (f->dbuf && io61_set_direct(f, false) < 0) {
+        return -1;
+    }
+    struct iovec iov[IOV_MAX];
+    int niov = 0;
+    off_t runoff = 0, runend = 0;
+    std::vector<off_t> tags;
+    tags.reserve(f->dirty.size());
+    for (auto& it : f->dirty) {
+        tags.push_back(it.first);
+    }
+    std::sort(tags.begin(), tags.end());
+    for (off_t tag : tags) {
+        io61_dirty* blk = f->dirty[tag].get();
+        size_t lo = 0;
+        while (lo != IO61_SLOTSIZE) {
+            size_t hi = lo;
+            if (blk->nvalid == IO61_SLOTSIZE) {
+                hi = IO61_SLOTSIZE;
+            } else {
+                while (lo != IO61_SLOTSIZE
+                       && !(blk->valid[lo / 64] & ((uint64_t) 1 << lo % 64))) {
+                    ++lo;
+                }
+                hi = lo;
+                while (hi != IO61_SLOTSIZE
+                       && (blk->valid[hi / 64] & ((uint64_t) 1 << hi % 64))) {
+                    ++hi;
+                }
+            }
+            if (lo == hi) {
+                break;
+            }
+            if (niov != 0 && (tag + (off_t) lo != runend || niov == IOV_MAX)) {
+                if (io61_pwritev(f, iov, niov, runoff) < 0) {
+                    return -1;
+                }
+                niov = 0;
+            }
+            if (niov == 0) {
+                runoff = tag + lo;
+            }
+            iov[niov].iov_base = blk->buf + lo;
+            iov[niov].iov_len = hi - lo;
+            ++niov;
+            runend = tag + hi;
+            lo = hi;
+        }
+    }
+    if (niov != 0 && io61_pwritev(f, iov, niov, runoff) < 0) {
+        return -1;
+    }
+    f->dirty.clear();
+    f->ndirty = 0;
+    return 0;
+}
+
+
+// io61_setsize(f, size)
+//    Declare that write-only file `f` will be `size` bytes long, and
+//    make it that long now. If `f` is a regular file, the data up to
+//    `size` is then written through a shared mapping of the file: seeks
+//    and writes within it make no system calls, and random-order writes
+//    need no write-behind. Writing past `size` ends the mapping. Returns
+//    0 on success and -1 on error.
+
+int io61_setsize(io61_file* f, off_t size) {
+    if (f->mode == O_RDONLY || f->shared || f->compressed || size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    off_t pos = f->wtag + f->wpos;
+    if (io61_flush(f) < 0 || (f->map && io61_unmap_output(f) < 0)
+        || ftruncate(f->fd, size) < 0) {
+        return -1;
+    }
+    if (!S_ISREG(f->ftype) || f->dbuf || size == 0 || pos > size) {
+        return 0;               // buffered writes work too
+    }
+    // mmap needs read access
+    char name[64];
+    snprintf(name, sizeof(name), "/proc/self/fd/%d", f->fd);
+    int fd = open(name, O_RDWR);
+    if (fd < 0) {
+        return 0;
+    }
+    // Faulting in the whole mapping at once is much cheaper than taking
+    // a fault as each page is first written.
+    void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, 0);
+    ++io61_my->mmap_calls;
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    io61_pool_put(f->wbuf, io61_bufmax);
+    f->map = f->wbuf = (unsigned char*) map;
+    f->mapsize = f->wsize = size;
+    f->wtag = 0;
+    f->wpos = pos;
     return 0;
 }
 
@@ -133,12 +2545,253 @@ int io61_flush(io61_file* f) {
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t pos) {
-    off_t r = lseek(f->fd, (off_t) pos, SEEK_SET);
-    if (r == (off_t) pos) {
-        return 0;
-    } else {
+    io61_timer timer(io61_lat_seek);
+    if (!f->seekable || pos < 0 || f->compressed) {
+        return -1;
+    }
+    if (f->mode == O_RDONLY) {
+        off_t jump = pos - (f->rtag + (off_t) f->rpos);
+        if (jump != 0) {
+            io61_observe(f, jump);
+        }
+        if (pos >= f->rtag && pos <= f->rtag + (off_t) f->rend) {
+            f->rpos = pos - f->rtag;
+        } else {
+            // Defer the cache lookup until the next read.
+            f->rbuf = nullptr;
+            f->rtag = pos;
+            f->rpos = f->rend = 0;
+        }
+    } else if (f->shared) {
+        return io61_flush_shared(f, pos);
+    } else if (f->map && pos <= (off_t) f->mapsize) {
+        f->wpos = pos;          // `wtag == 0`
+    } else if (f->map && io61_unmap_output(f) < 0) {
         return -1;
+    } else if (pos != f->wtag + (off_t) f->wpos) {
+        // Hold the buffered data back so the blocks can be written in
+        // file order later.
+        io61_stash(f);
+        f->wtag = pos;
+        if (f->ndirty > IO61_DIRTY_MAX && io61_flush(f) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// io61_kcopy(out, in, n)
+//    Ask the kernel to move up to `n` bytes from `in`'s file position to
+//    `out`'s, choosing copy_file_range, sendfile or splice depending on
+//    the file types. Neither file may have buffered data. Returns the
+//    number of bytes moved, 0 at end of file, or -1 with `errno` set.
+//    `errno == ENOSYS` means no kernel mechanism applies.
+
+static ssize_t io61_kcopy(io61_file* out, io61_file* in, size_t n) {
+    n = std::min(n, (size_t) 1 << 30);
+    off_t inoff = in->rtag + in->rpos;
+    off_t outoff = out->wtag;
+    ssize_t r = -1;
+    errno = ENOSYS;
+
+    if (S_ISREG(in->ftype) && S_ISREG(out->ftype)) {
+        uint64_t t0 = io61_clock_start();
+        r = copy_file_range(in->fd, &inoff, out->fd, &outoff, n, 0);
+        io61_count_write(r, t0);
+    }
+    if (r < 0 && errno != EINTR && errno != EAGAIN
+        && S_ISREG(in->ftype)) {
+        // sendfile writes at `out`'s own file position
+        if (out->seekable && out->fdpos != outoff) {
+            ++io61_my->seek_calls;
+            if (lseek(out->fd, outoff, SEEK_SET) == (off_t) -1) {
+                return -1;
+            }
+            out->fdpos = outoff;
+        }
+        uint64_t t0 = io61_clock_start();
+        r = sendfile(out->fd, in->fd, &inoff, n);
+        io61_count_write(r, t0);
+        if (r > 0) {
+            out->fdpos += r;
+        }
+    }
+    if (r < 0 && errno != EINTR && errno != EAGAIN
+        && (S_ISFIFO(in->ftype) || S_ISFIFO(out->ftype))) {
+        loff_t sinoff = inoff, soutoff = outoff;
+        uint64_t t0 = io61_clock_start();
+        r = splice(in->fd, in->seekable ? &sinoff : nullptr,
+                   out->fd, out->seekable ? &soutoff : nullptr,
+                   n, SPLICE_F_MOVE);
+        io61_count_write(r, t0);
+        if (r > 0 && !in->seekable) {
+            in->fdpos += r;
+        }
+        if (r > 0 && !out->seekable) {
+            out->fdpos += r;
+        }
+    }
+
+    if (r > 0) {
+        if (in->map) {
+            in->rpos += r;
+        } else {
+            in->rbuf = nullptr;
+            in->rtag += in->rpos + r;
+            in->rpos = in->rend = 0;
+        }
+        out->wtag += r;
+    }
+    return r;
+}
+
+
+// io61_copy(out, in, n)
+//    Copy up to `n` bytes from `in` to `out`, stopping early at end of
+//    file. Pass SIZE_MAX to copy everything. Data already buffered in
+//    either file is handled first; the rest moves inside the kernel
+//    when possible, falling back to a buffered copy. Returns the number
+//    of bytes copied, or -1 if an error occurred before any were.
+
+ssize_t io61_copy(io61_file* out, io61_file* in, size_t n) {
+    assert(in->mode == O_RDONLY && out->mode == O_WRONLY);
+    size_t ncopied = 0;
+
+    // Bytes in an unmapped read window are already out of the kernel.
+    if (!in->map && !in->async && in->rpos < in->rend) {
+        size_t m = std::min(n, in->rend - in->rpos);
+        ssize_t w = io61_write(out, (const char*) in->rbuf + in->rpos, m);
+        if (w < 0) {
+            return -1;
+        }
+        in->rpos += w;
+        ncopied += w;
+    }
+    if (io61_flush(out) < 0) {
+        return ncopied ? (ssize_t) ncopied : -1;
+    }
+
+    // The read-ahead helper owns an IO61_ASYNC file's descriptor,
+    // IO61_DIRECT files stay out of the page cache the kernel would use,
+    // and mapped output is quickest copied into the mapping.
+    bool kernel = !in->async && !in->dbuf && !out->dbuf && !out->compressed
+        && !out->map;
+    bool kernel_worked = false;
+    while (ncopied != n) {
+        ssize_t r = -1;
+        if (kernel) {
+            r = io61_kcopy(out, in, n - ncopied);
+            if (r < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            } else if (r < 0 && !kernel_worked) {
+                kernel = false;     // fall back to buffered copy
+                continue;
+            }
+            kernel_worked = true;
+        } else {
+            char buf[BUFSIZ * 8];
+            r = io61_read(in, buf, std::min(n - ncopied, sizeof(buf)));
+            if (r > 0 && io61_write(out, buf, r) != r) {
+                r = -1;
+            }
+        }
+        if (r <= 0) {
+            if (r < 0 && ncopied == 0) {
+                return -1;
+            }
+            break;
+        }
+        ncopied += r;
+    }
+    return ncopied;
+}
+
+
+// io61_copyall(outs, ins, n)
+//    Copy each input `ins[i]` to output `outs[i]` until end of file,
+//    for `i` in `[0, n)`, overlapping the copies. A poll() loop moves up
+//    to one buffer for every pair whose input is ready, so a slow pipe
+//    doesn't hold up the other copies, and a pipe's writer isn't kept
+//    waiting while regular files copy. Regular files are always ready.
+//    Each output is flushed at the end. Returns 0 on success and -1 if
+//    any copy failed.
+
+int io61_copyall(io61_file** outs, io61_file** ins, size_t n) {
+    std::vector<size_t> live;
+    for (size_t i = 0; i != n; ++i) {
+        assert(ins[i]->mode == O_RDONLY && outs[i]->mode == O_WRONLY);
+        live.push_back(i);
+    }
+    std::vector<struct pollfd> pfds;
+    int status = 0;
+
+    while (!live.empty()) {
+        // Poll only for pipes and sockets with nothing buffered. If
+        // other inputs are ready, don't block, but still service any
+        // pipes that are ready in the same pass.
+        pfds.clear();
+        bool anyready = false, anypipe = false;
+        for (size_t i : live) {
+            io61_file* in = ins[i];
+            bool ready = in->seekable || in->map || in->async
+                || in->rpos < in->rend || in->backpos != in->backlog.size();
+            pfds.push_back({ready ? -1 : in->fd, POLLIN, 0});
+            anyready = anyready || ready;
+            anypipe = anypipe || !ready;
+        }
+        if (anypipe
+            && poll(pfds.data(), pfds.size(), anyready ? 0 : -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        size_t k = 0;
+        for (size_t j = 0; j != pfds.size(); ++j) {
+            size_t i = live[j];
+            io61_file* in = ins[i];
+            ssize_t r = 1;
+            if (pfds[j].fd < 0 || pfds[j].revents) {
+                r = in->rpos < in->rend ? in->rend - in->rpos : io61_fill(in);
+                if (r > 0) {
+                    size_t m = std::min((size_t) r, io61_bufmax);
+                    if (io61_write(outs[i], (const char*) in->rbuf + in->rpos,
+                                   m) != (ssize_t) m) {
+                        r = -1;
+                    }
+                    in->rpos += m;
+                }
+            }
+            if (r < 0) {
+                status = -1;
+            }
+            if (r > 0) {
+                live[k++] = i;          // still copying
+            }
+        }
+        live.resize(k);
+    }
+
+    for (size_t i = 0; i != n; ++i) {
+        if (io61_flush(outs[i]) < 0) {
+            status = -1;
+        }
     }
+    return status;
+}
+
+
+// io61_zopen(filename, mode)
+//    Like io61_open_check, but the file holds an lz61 compressed stream:
+//    data written to the returned file is compressed, and data read from
+//    it is decompressed. A helper thread runs the codec on one buffer
+//    while the caller fills or empties the next. Compressed files can't
+//    seek, and their size is unknown.
+
+io61_file* io61_zopen(const char* filename, int mode) {
+    return io61_open_check(filename, mode | IO61_LZ61);
 }
 
 
@@ -153,7 +2806,7 @@ int io61_seek(io61_file* f, off_t pos) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename) {
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_FLAGS, 0666);
     } else if ((mode & O_ACCMODE) == O_RDONLY) {
         fd = STDIN_FILENO;
     } else {
@@ -163,7 +2816,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_FLAGS));
 }
 
 
@@ -172,6 +2825,9 @@ io61_file* io61_open_check(const char* filename, int mode) {
 //    well-defined size (for instance, if it is a pipe).
 
 off_t io61_filesize(io61_file* f) {
+    if (f->compressed) {
+        return -1;
+    }
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r >= 0 && S_ISREG(s.st_mode)) {
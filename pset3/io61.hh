@@ -6,17 +6,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/uio.h>
 #include <vector>
 
 struct io61_file;
 
+// Extra `mode` flags for io61_fdopen and io61_open_check. They live above
+// the O_ flags and are never passed to open(2).
+#define IO61_ASYNC      0x10000000  // read ahead in a helper thread
+#define IO61_SHARED     0x20000000  // writers may be called concurrently
+#define IO61_DIRECT     0x40000000  // bypass the page cache (O_DIRECT)
+#define IO61_LZ61       0x08000000  // lz61 compressed stream (io61_zopen)
+#define IO61_FLAGS      (IO61_ASYNC | IO61_SHARED | IO61_DIRECT | IO61_LZ61)
+
 io61_file* io61_fdopen(int fd, int mode);
 io61_file* io61_open_check(const char* filename, int mode);
+io61_file* io61_zopen(const char* filename, int mode);
 int io61_close(io61_file* f);
 
 off_t io61_filesize(io61_file* f);
 
 int io61_seek(io61_file* f, off_t pos);
+int io61_setsize(io61_file* f, off_t size);
 
 int io61_readc(io61_file* f);
 int io61_writec(io61_file* f, int ch);
@@ -24,17 +35,117 @@ int io61_writec(io61_file* f, int ch);
 ssize_t io61_read(io61_file* f, char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz);
 
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz);
+ssize_t io61_read_backwards(io61_file* f, char* buf, size_t sz);
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off);
+int io61_prefetch(io61_file* f, const off_t* offs, size_t n,
+                  size_t blocksize);
+
+int io61_peek(io61_file* f, const char** ptr, size_t* len);
+int io61_consume(io61_file* f, size_t n);
+int io61_reserve(io61_file* f, char** ptr, size_t* len);
+int io61_commit(io61_file* f, size_t n);
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt);
+
 int io61_flush(io61_file* f);
 
+ssize_t io61_copy(io61_file* out, io61_file* in, size_t n);
+int io61_copyall(io61_file** outs, io61_file** ins, size_t n);
+
+int io61_pair(io61_file* inf, io61_file* outf);
+
 void io61_profile_begin();
 void io61_profile_end();
 
 
+// io61_histogram
+//    Latency histogram in nanoseconds, bucketed like HdrHistogram:
+//    values below 8 have their own buckets, and each larger power of two
+//    is split into 8 buckets, so values sharing a bucket are within
+//    12.5% of each other.
+
+#define IO61_HIST_NBUCKETS 496
+
+struct io61_histogram {
+    unsigned long long count[IO61_HIST_NBUCKETS];
+
+    static unsigned bucket(unsigned long long ns) {
+        if (ns < 8) {
+            return ns;
+        }
+        unsigned e = 63 - __builtin_clzll(ns);
+        return (e - 2) * 8 + ((ns >> (e - 3)) & 7);
+    }
+    void add(unsigned long long ns) {
+        ++count[bucket(ns)];
+    }
+    unsigned long long total() const;
+    unsigned long long percentile(double p) const;
+};
+
+// Operations timed when IO61_LATENCY=1 is in the environment.
+enum io61_latency_op {
+    io61_lat_read,              // io61_read
+    io61_lat_write,             // io61_write
+    io61_lat_seek,              // io61_seek
+    io61_lat_flush,             // io61_flush
+    io61_lat_miss,              // read cache misses, including the read
+    io61_lat_sysread,           // read system calls
+    io61_lat_syswrite,          // write system calls and in-kernel copies
+    io61_nlat
+};
+
+
+// io61_stats
+//    Counters maintained by the io61 implementation and printed by
+//    io61_profile_end(). Implementations that don't cache leave them 0.
+
+struct io61_stats {
+    unsigned long long cache_hits;      // cache lookups satisfied
+    unsigned long long cache_misses;    // cache lookups that read the file
+    unsigned long long read_bufsize;    // largest read size chosen
+    unsigned long long write_bufsize;   // largest write buffer size chosen
+    unsigned long long read_calls;      // read, readv, pread
+    unsigned long long write_calls;     // write, writev, pwritev, and
+                                        // in-kernel copies
+    unsigned long long seek_calls;      // lseek
+    unsigned long long mmap_calls;      // mmap, munmap, madvise
+    unsigned long long bytes_read;      // bytes returned by read calls
+    unsigned long long bytes_written;   // bytes accepted by write calls
+    unsigned long long bytes_copied;    // bytes moved by memcpy
+    unsigned long long direct_files;    // files closed in IO61_DIRECT mode
+    unsigned long long cached_bytes;    // their bytes left in the page cache
+    unsigned long long zplain_bytes;    // data bytes through lz61 streams
+    unsigned long long zpacked_bytes;   // their compressed size
+    io61_histogram latency[io61_nlat];  // IO61_LATENCY=1 only
+};
+
+extern io61_stats io61_stat;
+extern bool io61_profiling;     // between io61_profile_begin and _end
+
+
 struct io61_arguments {
     size_t input_size;          // `-s` option: input size. Default SIZE_MAX
     size_t block_size;          // `-b` option: block size. Default 0
     size_t stride;              // `-t` option: stride. Default 1024
+    size_t nthreads;            // `-j` option: thread count. Default 0
+    size_t iovcnt;              // `-v` option: buffers per io61_readv
+                                // and io61_writev. Default 0
     bool lines;                 // `-l` option: read by lines. Default false
+    bool copy;                  // `-c` option: use io61_copy. Default false
+    bool async;                 // `-a` option: open input IO61_ASYNC.
+                                // Default false
+    bool borrow;                // `-p` option: copy with io61_peek and
+                                // io61_reserve. Default false
+    bool direct;                // `-d` option: open files IO61_DIRECT.
+                                // Default false
+    bool uncompress;            // `-u` option: decompress. Default false
+    bool map_output;            // `-m` option: io61_setsize the output.
+                                // Default false
+    bool prefetch;              // `-f` option: io61_prefetch upcoming
+                                // blocks. Default false
     const char* output_file;    // `-o` option: output file. Default nullptr
     const char* input_file;     // input file. Default nullptr
     std::vector<const char*> input_files;   // all input files
@@ -0,0 +1,340 @@
+#include "lz61.hh"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+
+// lz61.c
+//    A small LZ4-style block compressor shared by every io61
+//    implementation, so all of them produce the same compressed files.
+
+#define LZ61_HASHBITS 12        // log2 of the match finder's table size
+#define LZ61_MINMATCH 4
+
+
+static inline uint32_t lz61_load32(const unsigned char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint32_t lz61_hash(uint32_t x) {
+    return (x * 2654435761U) >> (32 - LZ61_HASHBITS);
+}
+
+
+// lz61_bound(n)
+//    Return the largest payload lz61_pack can produce for `n` bytes of
+//    data, not counting the header.
+
+size_t lz61_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+
+// lz61_put_length(op, len)
+//    Write the extra bytes of a length that didn't fit in its token.
+
+static unsigned char* lz61_put_length(unsigned char* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+
+// lz61_sequence(op, lit, nlit, offset, mlen)
+//    Write a sequence of `nlit` literal bytes from `lit` followed by a
+//    copy of `mlen` bytes from `offset` bytes back. The last sequence of
+//    a block has `mlen == 0` and no offset.
+
+static unsigned char* lz61_sequence(unsigned char* op, const unsigned char* lit,
+                                    size_t nlit, size_t offset, size_t mlen) {
+    unsigned char* token = op++;
+    *token = (nlit < 15 ? nlit : 15) << 4;
+    if (nlit >= 15) {
+        op = lz61_put_length(op, nlit - 15);
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen != 0) {
+        *op++ = offset;
+        *op++ = offset >> 8;
+        mlen -= LZ61_MINMATCH;
+        *token |= mlen < 15 ? mlen : 15;
+        if (mlen >= 15) {
+            op = lz61_put_length(op, mlen - 15);
+        }
+    }
+    return op;
+}
+
+
+// lz61_compress(dst, src, n)
+//    Compress `n` bytes from `src` into `dst`, which must have room for
+//    lz61_bound(n) bytes, and return the compressed size. A hash table
+//    remembers the last position of each 4-byte string; matches are
+//    taken greedily. The search skips ahead faster the longer it goes
+//    without a match, so incompressible data costs little.
+
+static size_t lz61_compress(unsigned char* dst, const unsigned char* src,
+                            size_t n) {
+    uint32_t table[1 << LZ61_HASHBITS];
+    memset(table, 0, sizeof(table));
+    unsigned char* op = dst;
+    size_t anchor = 0, ip = 0;
+
+    while (ip + LZ61_MINMATCH <= n) {
+        uint32_t seq = lz61_load32(src + ip);
+        uint32_t h = lz61_hash(seq);
+        size_t ref = table[h];
+        table[h] = ip;
+        if (ref >= ip || ip - ref > 65535 || lz61_load32(src + ref) != seq) {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        // Extend the match 8 bytes at a time; the first unequal byte is
+        // the lowest (little-endian) or highest set byte of the difference.
+        size_t len = LZ61_MINMATCH;
+        while (ip + len + 8 <= n) {
+            uint64_t a, b;
+            memcpy(&a, src + ip + len, 8);
+            memcpy(&b, src + ref + len, 8);
+            if (a != b) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                len += __builtin_clzll(a ^ b) / 8;
+#else
+                len += __builtin_ctzll(a ^ b) / 8;
+#endif
+                break;
+            }
+            len += 8;
+        }
+        while (ip + len < n && src[ip + len] == src[ref + len]) {
+            ++len;
+        }
+        op = lz61_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+        if (ip + LZ61_MINMATCH <= n && ip >= 2) {
+            table[lz61_hash(lz61_load32(src + ip - 2))] = ip - 2;
+        }
+    }
+
+    op = lz61_sequence(op, src + anchor, n - anchor, 0, 0);
+    return op - dst;
+}
+
+
+// lz61_decompress(dst, dstsz, src, n)
+//    Decompress the `n`-byte payload at `src` into `dst`, which has room
+//    for `dstsz` bytes. Returns the decompressed size, or -1 if the
+//    payload is corrupt.
+
+static ssize_t lz61_decompress(unsigned char* dst, size_t dstsz,
+                               const unsigned char* src, size_t n) {
+    const unsigned char* ip = src;
+    const unsigned char* iend = src + n;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + dstsz;
+
+    while (ip != iend) {
+        unsigned token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15) {
+            unsigned char b;
+            do {
+                if (ip == iend) {
+                    return -1;
+                }
+                b = *ip++;
+                nlit += b;
+            } while (b == 255);
+        }
+        if (nlit > (size_t) (iend - ip) || nlit > (size_t) (oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == iend) {
+            break;              // last sequence has no match
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            unsigned char b;
+            do {
+                if (ip == iend) {
+                    return -1;
+                }
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ61_MINMATCH;
+        if (offset == 0 || offset > (size_t) (op - dst)
+            || mlen > (size_t) (oend - op)) {
+            return -1;
+        }
+        const unsigned char* m = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, m, mlen);
+            op += mlen;
+        } else {
+            // overlapping copy repeats the last `offset` bytes
+            for (size_t i = 0; i != mlen; ++i) {
+                *op++ = m[i];
+            }
+        }
+    }
+    return op - dst;
+}
+
+
+// lz61_pack(dst, src, n)
+//    Write one block, header and payload, holding the `n` bytes at `src`
+//    (`0 < n <= LZ61_BLOCKSIZE`) to `dst`, which must have room for
+//    LZ61_HEADER + lz61_bound(n) bytes. Returns the block's size.
+
+size_t lz61_pack(unsigned char* dst, const unsigned char* src, size_t n) {
+    size_t packed = lz61_compress(dst + LZ61_HEADER, src, n);
+    if (packed >= n) {
+        memcpy(dst + LZ61_HEADER, src, n);
+        packed = n;
+    }
+    for (int i = 0; i != 4; ++i) {
+        dst[i] = packed >> (8 * i);
+        dst[4 + i] = n >> (8 * i);
+    }
+    return LZ61_HEADER + packed;
+}
+
+
+// lz61_header(hdr, packed, plain)
+//    Decode the block header at `hdr` into its payload length `*packed`
+//    and data length `*plain`. Returns 0 on success and -1 if the
+//    header is invalid.
+
+int lz61_header(const unsigned char* hdr, size_t* packed, size_t* plain) {
+    *packed = *plain = 0;
+    for (int i = 0; i != 4; ++i) {
+        *packed |= (size_t) hdr[i] << (8 * i);
+        *plain |= (size_t) hdr[4 + i] << (8 * i);
+    }
+    if (*plain == 0 || *plain > LZ61_BLOCKSIZE
+        || *packed == 0 || *packed > lz61_bound(*plain)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+// lz61_unpack(dst, src, packed, plain)
+//    Decode a `packed`-byte payload into the `plain` bytes of data it
+//    holds. Returns 0 on success and -1 if the payload is corrupt.
+
+int lz61_unpack(unsigned char* dst, const unsigned char* src,
+                size_t packed, size_t plain) {
+    if (packed == plain) {
+        memcpy(dst, src, plain);
+        return 0;
+    }
+    return lz61_decompress(dst, plain, src, packed) == (ssize_t) plain ? 0 : -1;
+}
+
+
+// lz61_read(fd, buf, sz)
+//    Read until `sz` bytes arrive or the file ends. Returns the number of
+//    bytes read, or -1 on error.
+
+static ssize_t lz61_read(int fd, unsigned char* buf, size_t sz) {
+    size_t n = 0;
+    while (n != sz) {
+        ssize_t r = read(fd, buf + n, sz - n);
+        if (r > 0) {
+            n += r;
+        } else if (r == 0) {
+            break;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+
+// lz61_write(fd, buf, sz)
+//    Write all `sz` bytes. Sockets are written with MSG_NOSIGNAL, so a
+//    reader that closes early causes an error rather than SIGPIPE.
+//    Returns 0 on success and -1 on error.
+
+static int lz61_write(int fd, const unsigned char* buf, size_t sz) {
+    bool sock = true;
+    size_t n = 0;
+    while (n != sz) {
+        ssize_t r = sock ? send(fd, buf + n, sz - n, MSG_NOSIGNAL)
+            : write(fd, buf + n, sz - n);
+        if (r == -1 && sock && errno == ENOTSOCK) {
+            sock = false;
+        } else if (r > 0) {
+            n += r;
+        } else if (r == -1 && errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// lz61_pump(infd, outfd, compress)
+//    Copy `infd` to `outfd` until end of file, compressing full
+//    LZ61_BLOCKSIZE blocks or, if `!compress`, decompressing blocks.
+//    Closes `outfd` when done. If writing a compressed block fails, the
+//    rest of the input is read and discarded, so its writer can't block.
+//    Returns 0 on success and -1 on error.
+
+int lz61_pump(int infd, int outfd, bool compress) {
+    std::vector<unsigned char> plain(LZ61_BLOCKSIZE);
+    std::vector<unsigned char> packed(LZ61_HEADER + lz61_bound(LZ61_BLOCKSIZE));
+    int status = 0;
+    while (true) {
+        ssize_t n;
+        if (compress) {
+            n = lz61_read(infd, plain.data(), LZ61_BLOCKSIZE);
+            if (n <= 0) {
+                status = n < 0 ? -1 : status;
+                break;
+            } else if (status == 0) {
+                size_t len = lz61_pack(packed.data(), plain.data(), n);
+                status = lz61_write(outfd, packed.data(), len);
+            }
+            continue;
+        }
+        size_t psz, dsz;
+        n = lz61_read(infd, packed.data(), LZ61_HEADER);
+        if (n <= 0) {
+            status = n < 0 ? -1 : status;
+            break;
+        } else if (n != LZ61_HEADER
+                   || lz61_header(packed.data(), &psz, &dsz) < 0
+                   || lz61_read(infd, packed.data(), psz) != (ssize_t) psz
+                   || lz61_unpack(plain.data(), packed.data(), psz, dsz) < 0
+                   || lz61_write(outfd, plain.data(), dsz) < 0) {
+            status = -1;
+            break;
+        }
+    }
+    close(outfd);
+    return status;
+}
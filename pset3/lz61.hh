@@ -0,0 +1,27 @@
+#ifndef LZ61_HH
+#define LZ61_HH
+#include <stddef.h>
+#include <sys/types.h>
+
+// lz61 block format
+//    An lz61 stream is a sequence of blocks, each holding at most
+//    LZ61_BLOCKSIZE bytes of data. A block starts with an LZ61_HEADER-byte
+//    header: the payload length and the data length, each a 4-byte
+//    little-endian number. Equal lengths mean the data is stored as is;
+//    otherwise the payload is a series of LZ4-style sequences (a token, a
+//    run of literal bytes, and a 2-byte offset and length of an earlier
+//    run to copy). Blocks are independent. Writers fill every block but
+//    the last, so equal data compresses to equal streams.
+
+#define LZ61_BLOCKSIZE  65536
+#define LZ61_HEADER     8
+
+size_t lz61_bound(size_t n);
+size_t lz61_pack(unsigned char* dst, const unsigned char* src, size_t n);
+int lz61_header(const unsigned char* hdr, size_t* packed, size_t* plain);
+int lz61_unpack(unsigned char* dst, const unsigned char* src,
+                size_t packed, size_t plain);
+
+int lz61_pump(int infd, int outfd, bool compress);
+
+#endif
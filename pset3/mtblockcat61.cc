@@ -0,0 +1,69 @@
+#include "io61.hh"
+#include <thread>
+
+// Usage: ./mtblockcat61 [-b BLOCKSIZE] [-j THREADS] [-p] [-o OUTFILE] FILE
+//    Copies the input FILE to OUTFILE in blocks using THREADS threads.
+//    Thread `t` reads blocks `t`, `t + THREADS`, ... with io61_pread
+//    and appends each one to the shared OUTFILE with io61_write, so
+//    OUTFILE holds FILE's blocks in some order.
+//    With `-p`, each block first asks for output space with
+//    io61_reserve, which shared files must refuse with EINVAL; the
+//    program aborts if it doesn't.
+//    Default BLOCKSIZE is 4096; default THREADS is 4.
+
+static void copy_blocks(io61_file* inf, io61_file* outf, off_t size,
+                        size_t block_size, size_t t, size_t nthreads,
+                        bool borrow) {
+    char* buf = new char[block_size];
+    for (off_t off = t * block_size; off < size;
+         off += nthreads * block_size) {
+        ssize_t amount = io61_pread(inf, buf, block_size, off);
+        if (amount <= 0) {
+            break;
+        }
+        char* obuf;
+        size_t olen;
+        if (borrow && (io61_reserve(outf, &obuf, &olen) != -1
+                       || errno != EINVAL
+                       || io61_commit(outf, 0) != -1)) {
+            fprintf(stderr, "mtblockcat61: io61_reserve or io61_commit "
+                    "accepted a shared file\n");
+            abort();
+        }
+        io61_write(outf, buf, amount);
+    }
+    delete[] buf;
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:j:po:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+    size_t nthreads = args.nthreads ? args.nthreads : 4;
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC
+                                      | IO61_SHARED);
+    off_t size = io61_filesize(inf);
+    if (size < 0) {
+        fprintf(stderr, "mtblockcat61: input file is not seekable\n");
+        exit(1);
+    }
+
+    // Copy file data
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != nthreads; ++t) {
+        threads.emplace_back(copy_blocks, inf, outf, size, block_size,
+                             t, nthreads, args.borrow);
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
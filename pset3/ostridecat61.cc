@@ -1,15 +1,16 @@
 #include "io61.hh"
 
-// Usage: ./ostridecat61 [-b BLOCKSIZE] [-t STRIDE] [-o OUTFILE] [FILE]
+// Usage: ./ostridecat61 [-b BLOCKSIZE] [-t STRIDE] [-m] [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE in blocks, shuffling its
 //    contents. Reads FILE sequentially, but writes to its output in a
 //    strided access pattern. Default BLOCKSIZE is 1 and default STRIDE is
 //    1024. This means the output file's bytes are written in the sequence
-//    0, 1024, 2048, ..., 1, 1025, 2049, ..., etc.
+//    0, 1024, 2048, ..., 1, 1025, 2049, ..., etc. With `-m`, sizes the
+//    output with `io61_setsize` first.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args(argc, argv, "b:t:o:i:");
+    io61_arguments args(argc, argv, "b:t:mo:i:");
     size_t block_size = args.block_size ? args.block_size : 1;
 
     // Allocate buffer, open files, measure file sizes
@@ -30,6 +31,10 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "ostridecat61: output file is not seekable\n");
         exit(1);
     }
+    if (args.map_output && io61_setsize(outf, args.input_size) < 0) {
+        fprintf(stderr, "ostridecat61: cannot size output file\n");
+        exit(1);
+    }
 
     // Copy file data
     size_t pos = 0, written = 0;
@@ -0,0 +1,41 @@
+#include "io61.hh"
+
+// Usage: ./parcat61 [-i IFILE | -o OFILE]...
+//    Copies the input IFILEs to the output OFILEs in parallel. With M
+//    OFILEs, the IFILEs are taken in rounds of M: in each round, the
+//    k-th IFILE of the round is appended to the k-th OFILE, and all the
+//    copies in the round overlap using `io61_copyall`. (Unlike
+//    scattergather61, each input stays whole.)
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "i:o:##");
+
+    // Open files
+    io61_profile_begin();
+    std::vector<io61_file*> outfs;
+    for (auto filename : args.output_files) {
+        outfs.push_back(io61_open_check(filename,
+                                        O_WRONLY | O_CREAT | O_TRUNC));
+    }
+
+    // Copy file data, one round of inputs at a time
+    for (size_t ini = 0; ini < args.input_files.size();
+         ini += outfs.size()) {
+        size_t n = std::min(outfs.size(), args.input_files.size() - ini);
+        std::vector<io61_file*> infs;
+        for (size_t k = 0; k != n; ++k) {
+            infs.push_back(io61_open_check(args.input_files[ini + k],
+                                           O_RDONLY));
+        }
+        io61_copyall(outfs.data(), infs.data(), n);
+        for (auto f : infs) {
+            io61_close(f);
+        }
+    }
+
+    for (auto f : outfs) {
+        io61_close(f);
+    }
+    io61_profile_end();
+}
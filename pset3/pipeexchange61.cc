@@ -22,6 +22,14 @@ static const struct message_set messages[] = {
     { 20, 10000, 10000 }
 };
 
+// Usage: ./pipeexchange61 [-S]
+//    The processes talk over two pipes, or over one socketpair with -S,
+//    and pair their io61 files with io61_pair, so buffered requests are
+//    flushed before a read blocks. The requester reports the round-trip
+//    latency of each message set on stderr, and its io61 profile; run
+//    with IO61_LATENCY=1 to see the latency distribution of its reads,
+//    which wait for replies.
+
 // Requester algorithm:
 //    for (i = 0; i < request_batch; ++i) {
 //        send request of size request_size;
@@ -63,17 +71,22 @@ void requester(io61_file* outf, io61_file* inf) {
     size_t requestid = 0;
     size_t responseid = 0;
     size_t id;
+    io61_profile_begin();
+    int x = io61_pair(inf, outf);
+    assert(x >= 0);
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
         const struct message_set* m = &messages[mindex];
+        struct timespec t0, t1;
         printf("requester: phase %zd/%zd\n", mindex, nmessages);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
         for (int i = 0; i < m->request_batch; ++i) {
             memcpy(buf, &requestid, sizeof(size_t));
             ++requestid;
             ssize_t r = io61_write(outf, buf, m->request_size);
             assert((size_t) r == m->request_size);
         }
-        int x = io61_flush(outf);
+        x = io61_flush(outf);
         assert(x >= 0);
         for (int i = 0; i < m->request_batch; ++i) {
             ssize_t r = io61_read(inf, buf, m->response_size);
@@ -82,11 +95,16 @@ void requester(io61_file* outf, io61_file* inf) {
             assert(id == responseid);
             ++responseid;
         }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        fprintf(stderr, "requester: phase %zd/%zd: %d x %zdB in %.1fus\n",
+                mindex, nmessages, m->request_batch, m->request_size,
+                (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3);
     }
 
     printf("requester: done!\n");
     io61_close(inf);
     io61_close(outf);
+    io61_profile_end();
     delete[] buf;
     exit(0);
 }
@@ -96,6 +114,8 @@ void responder(io61_file* outf, io61_file* inf) {
     size_t maxsz = max_message_size();
     char* buf = new char[maxsz];
     memset(buf, 0, maxsz);
+    int x = io61_pair(inf, outf);
+    assert(x >= 0);
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
         const struct message_set* m = &messages[mindex];
@@ -104,7 +124,7 @@ void responder(io61_file* outf, io61_file* inf) {
             assert((size_t) r == m->request_size);
             r = io61_write(outf, buf, m->response_size);
             assert((size_t) r == m->response_size);
-            int x = io61_flush(outf);
+            x = io61_flush(outf);
             assert(x >= 0);
         }
     }
@@ -116,23 +136,45 @@ void responder(io61_file* outf, io61_file* inf) {
 }
 
 int main(int argc, char* argv[]) {
-    (void) argc, (void) argv;
-
-    // create a connected socket pair for communicating between processes
-    int request_fds[2], response_fds[2];
-    int r1 = pipe(request_fds), r2 = pipe(response_fds);
-    if (r1 < 0 || r2 < 0) {
-        perror("pipe");
+    bool use_socket = argc == 2 && strcmp(argv[1], "-S") == 0;
+    if (argc > 2 || (argc == 2 && !use_socket)) {
+        fprintf(stderr, "Usage: %s [-S]\n", argv[0]);
         exit(1);
     }
 
+    // create the channels between the processes; a socket carries both
+    // directions, so each process gets two descriptors for its end
+    int requester_out, requester_in, responder_out, responder_in;
+    if (use_socket) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        requester_out = fds[0];
+        requester_in = dup(fds[0]);
+        responder_out = fds[1];
+        responder_in = dup(fds[1]);
+    } else {
+        int request_fds[2], response_fds[2];
+        int r1 = pipe(request_fds), r2 = pipe(response_fds);
+        if (r1 < 0 || r2 < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        requester_out = request_fds[1];
+        requester_in = response_fds[0];
+        responder_out = response_fds[1];
+        responder_in = request_fds[0];
+    }
+
     // fork two children
     pid_t p1 = fork();
     if (p1 == 0) {
-        close(request_fds[0]);
-        close(response_fds[1]);
-        requester(io61_fdopen(request_fds[1], O_WRONLY),
-                  io61_fdopen(response_fds[0], O_RDONLY));
+        close(responder_out);
+        close(responder_in);
+        requester(io61_fdopen(requester_out, O_WRONLY),
+                  io61_fdopen(requester_in, O_RDONLY));
     } else if (p1 < 0) {
         perror("fork");
         exit(1);
@@ -140,14 +182,18 @@ int main(int argc, char* argv[]) {
 
     pid_t p2 = fork();
     if (p2 == 0) {
-        close(request_fds[1]);
-        close(response_fds[0]);
-        responder(io61_fdopen(response_fds[1], O_WRONLY),
-                  io61_fdopen(request_fds[0], O_RDONLY));
+        close(requester_out);
+        close(requester_in);
+        responder(io61_fdopen(responder_out, O_WRONLY),
+                  io61_fdopen(responder_in, O_RDONLY));
     } else if (p2 < 0) {
         perror("fork");
         exit(1);
     }
+    close(requester_out);
+    close(requester_in);
+    close(responder_out);
+    close(responder_in);
 
     time_t start_time = time(0);
     while ((p1 > 0 || p2 > 0) && time(0) < start_time + 5) {
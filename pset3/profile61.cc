@@ -2,6 +2,11 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <errno.h>
+#if __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 // profile61.c
 //    The profile functions measure how much time and memory are used
@@ -10,8 +15,132 @@
 //    parses common arguments into a structure.
 
 static struct timeval tv_begin;
+io61_stats io61_stat;
+bool io61_profiling;
+
+
+// Hardware and software event counters, reported when the kernel
+// provides them. Set IO61_PERF=0 to skip them. Latency percentiles are
+// reported too when IO61_LATENCY=1 (see io61_histogram).
+
+static struct {
+    const char* name;
+    unsigned type;
+    unsigned long long config;
+    int fd;
+} perf_counters[] = {
+#if __linux__
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+    {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+    {"page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1},
+    {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1},
+#endif
+    {nullptr, 0, 0, -1}
+};
+
+
+// perf_open(type, config)
+//    Open a disabled counter for this process and the threads it will
+//    create. Counts kernel events if permitted, else only user events.
+//    Returns the file descriptor or -1.
+
+static int perf_open(unsigned type, unsigned long long config) {
+#if __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+#else
+    (void) type, (void) config;
+    return -1;
+#endif
+}
+
+
+// perf_read(fd)
+//    Return the count on `fd`, scaled up for any time the kernel spent
+//    multiplexing it with other counters, or -1 if unavailable.
+
+static long long perf_read(int fd) {
+    unsigned long long v[3];    // value, time enabled, time running
+    if (read(fd, v, sizeof(v)) != (ssize_t) sizeof(v) || v[2] == 0) {
+        return -1;
+    }
+    return v[2] == v[1] ? v[0] : (long long) ((double) v[0] * v[1] / v[2]);
+}
+
+
+// Names of the latency histograms, for io61_profile_end.
+
+static const char* const latency_names[io61_nlat] = {
+    "read", "write", "seek", "flush", "miss", "sysread", "syswrite"
+};
+
+
+// io61_histogram::total()
+//    Return the number of values recorded.
+
+unsigned long long io61_histogram::total() const {
+    unsigned long long n = 0;
+    for (int b = 0; b != IO61_HIST_NBUCKETS; ++b) {
+        n += count[b];
+    }
+    return n;
+}
+
+
+// io61_histogram::percentile(p)
+//    Return the largest value in the bucket holding the `p`th fraction
+//    of recorded values (so `p == 1` returns about the maximum), or 0
+//    if the histogram is empty.
+
+unsigned long long io61_histogram::percentile(double p) const {
+    unsigned long long n = total();
+    unsigned long long rank = (unsigned long long) (p * n + 0.999999);
+    rank = rank ? rank : 1;
+    unsigned long long seen = 0;
+    for (int b = 0; b != IO61_HIST_NBUCKETS; ++b) {
+        seen += count[b];
+        if (seen >= rank && count[b]) {
+            if (b < 8) {
+                return b;
+            }
+            unsigned e = b / 8 + 2;
+            return ((9ULL + b % 8) << (e - 3)) - 1;
+        }
+    }
+    return 0;
+}
+
 
 void io61_profile_begin() {
+    const char* perf = getenv("IO61_PERF");
+    bool use_perf = !perf || strcmp(perf, "0") != 0;
+    for (int i = 0; use_perf && perf_counters[i].name; ++i) {
+        perf_counters[i].fd = perf_open(perf_counters[i].type,
+                                        perf_counters[i].config);
+    }
+#if __linux__
+    for (int i = 0; perf_counters[i].name; ++i) {
+        if (perf_counters[i].fd >= 0) {
+            ioctl(perf_counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    io61_profiling = true;
     int r = gettimeofday(&tv_begin, 0);
     assert(r >= 0);
 }
@@ -20,6 +149,7 @@ void io61_profile_end() {
     struct timeval tv_end;
     struct rusage usage, cusage;
 
+    io61_profiling = false;
     int r = gettimeofday(&tv_end, 0);
     assert(r >= 0);
     r = getrusage(RUSAGE_SELF, &usage);
@@ -27,16 +157,59 @@ void io61_profile_end() {
     r = getrusage(RUSAGE_CHILDREN, &cusage);
     assert(r >= 0);
 
+#if __linux__
+    for (int i = 0; perf_counters[i].name; ++i) {
+        if (perf_counters[i].fd >= 0) {
+            ioctl(perf_counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+
     timersub(&tv_end, &tv_begin, &tv_end);
     timeradd(&usage.ru_utime, &cusage.ru_utime, &usage.ru_utime);
     timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
 
-    char buf[1000];
-    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    unsigned long long lookups = io61_stat.cache_hits + io61_stat.cache_misses;
+    double hit_rate = lookups ? (double) io61_stat.cache_hits / lookups : 0;
+
+    char buf[4000];
+    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, \"cache_hits\":%llu, \"cache_misses\":%llu, \"cache_hit_rate\":%.4f, \"read_bufsize\":%llu, \"write_bufsize\":%llu, \"read_calls\":%llu, \"write_calls\":%llu, \"seek_calls\":%llu, \"mmap_calls\":%llu, \"bytes_read\":%llu, \"bytes_written\":%llu, \"bytes_copied\":%llu, \"direct_files\":%llu, \"cached_bytes\":%llu, \"zplain_bytes\":%llu, \"zpacked_bytes\":%llu",
                       tv_end.tv_sec, (long) tv_end.tv_usec,
                       usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
                       usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
-                      usage.ru_maxrss + cusage.ru_maxrss);
+                      usage.ru_maxrss + cusage.ru_maxrss,
+                      io61_stat.cache_hits, io61_stat.cache_misses, hit_rate,
+                      io61_stat.read_bufsize, io61_stat.write_bufsize,
+                      io61_stat.read_calls, io61_stat.write_calls,
+                      io61_stat.seek_calls, io61_stat.mmap_calls,
+                      io61_stat.bytes_read, io61_stat.bytes_written,
+                      io61_stat.bytes_copied,
+                      io61_stat.direct_files, io61_stat.cached_bytes,
+                      io61_stat.zplain_bytes, io61_stat.zpacked_bytes);
+    for (int i = 0; perf_counters[i].name; ++i) {
+        long long count;
+        if (perf_counters[i].fd >= 0
+            && (count = perf_read(perf_counters[i].fd)) >= 0) {
+            len += sprintf(buf + len, ", \"%s\":%lld",
+                           perf_counters[i].name, count);
+        }
+        if (perf_counters[i].fd >= 0) {
+            close(perf_counters[i].fd);
+            perf_counters[i].fd = -1;
+        }
+    }
+    for (int op = 0; op != io61_nlat; ++op) {
+        const io61_histogram& h = io61_stat.latency[op];
+        if (unsigned long long n = h.total()) {
+            len += sprintf(buf + len, ", \"lat_%s_n\":%llu, \"lat_%s_p50\":%llu, \"lat_%s_p99\":%llu, \"lat_%s_p999\":%llu, \"lat_%s_max\":%llu",
+                           latency_names[op], n,
+                           latency_names[op], h.percentile(0.5),
+                           latency_names[op], h.percentile(0.99),
+                           latency_names[op], h.percentile(0.999),
+                           latency_names[op], h.percentile(1));
+        }
+    }
+    len += sprintf(buf + len, "}\n");
 
     // Print the report to file descriptor 100 if it's available. Our
     // `check.pl` test harness uses this file descriptor.
@@ -54,7 +227,16 @@ io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
     input_size = -1;
     block_size = 0;
     stride = 1024;
+    nthreads = 0;
+    iovcnt = 0;
     lines = false;
+    copy = false;
+    async = false;
+    borrow = false;
+    direct = false;
+    uncompress = false;
+    map_output = false;
+    prefetch = false;
     output_file = input_file = nullptr;
     opts = opts_;
     program_name = argv[0];
@@ -81,9 +263,42 @@ io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
                 goto usage;
             }
             break;
+        case 'j':
+            nthreads = (size_t) strtoul(optarg, &endptr, 0);
+            if (nthreads == 0 || endptr == optarg || *endptr) {
+                goto usage;
+            }
+            break;
+        case 'v':
+            iovcnt = (size_t) strtoul(optarg, &endptr, 0);
+            if (iovcnt == 0 || endptr == optarg || *endptr) {
+                goto usage;
+            }
+            break;
         case 'l':
             lines = true;
             break;
+        case 'c':
+            copy = true;
+            break;
+        case 'a':
+            async = true;
+            break;
+        case 'p':
+            borrow = true;
+            break;
+        case 'd':
+            direct = true;
+            break;
+        case 'u':
+            uncompress = true;
+            break;
+        case 'm':
+            map_output = true;
+            break;
+        case 'f':
+            prefetch = true;
+            break;
         case 'r': {
             unsigned long seed = strtoul(optarg, &endptr, 0);
             if (endptr == optarg || *endptr) {
@@ -139,9 +354,36 @@ void io61_arguments::usage() {
     if (strchr(opts, 't')) {
         fprintf(stderr, " [-t STRIDE]");
     }
+    if (strchr(opts, 'j')) {
+        fprintf(stderr, " [-j THREADS]");
+    }
+    if (strchr(opts, 'v')) {
+        fprintf(stderr, " [-v COUNT]");
+    }
     if (strchr(opts, 'l')) {
         fprintf(stderr, " [-l]");
     }
+    if (strchr(opts, 'c')) {
+        fprintf(stderr, " [-c]");
+    }
+    if (strchr(opts, 'a')) {
+        fprintf(stderr, " [-a]");
+    }
+    if (strchr(opts, 'p')) {
+        fprintf(stderr, " [-p]");
+    }
+    if (strchr(opts, 'd')) {
+        fprintf(stderr, " [-d]");
+    }
+    if (strchr(opts, 'u')) {
+        fprintf(stderr, " [-u]");
+    }
+    if (strchr(opts, 'm')) {
+        fprintf(stderr, " [-m]");
+    }
+    if (strchr(opts, 'f')) {
+        fprintf(stderr, " [-f]");
+    }
     if (strchr(opts, 'o')) {
         fprintf(stderr, " [-o OUTFILE]");
     }
@@ -1,15 +1,19 @@
 #include "io61.hh"
+#include <algorithm>
 
-// Usage: ./reordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE]
+// Usage: ./reordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE] [-m] [-f]
 //                       [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE in blocks. The blocks are
 //    transferred in random order, but the resulting output file
 //    should be the same as the input. Default BLOCKSIZE is 4096.
+//    With `-m`, sizes the output with `io61_setsize` first. With `-f`,
+//    passes each batch of upcoming blocks to `io61_prefetch` while the
+//    batch before it is copied.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
     srandom(83419);
-    io61_arguments args(argc, argv, "b:r:s:o:i:");
+    io61_arguments args(argc, argv, "b:r:s:mfo:i:");
     size_t block_size = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files, measure file sizes
@@ -36,6 +40,10 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "reordercat61: output file is not seekable\n");
         exit(1);
     }
+    if (args.map_output && io61_setsize(outf, args.input_size) < 0) {
+        fprintf(stderr, "reordercat61: cannot size output file\n");
+        exit(1);
+    }
 
     // Calculate random permutation of file's blocks
     size_t nblocks = args.input_size / block_size;
@@ -47,20 +55,36 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
+    // Shuffle the block order; blocks are copied from the end backwards
     size_t* blockpos = new size_t[nblocks];
     for (size_t i = 0; i < nblocks; ++i) {
         blockpos[i] = i;
     }
+    for (size_t n = nblocks; n != 0; --n) {
+        size_t index = random() % n;
+        std::swap(blockpos[index], blockpos[n - 1]);
+    }
+
+    // Prefetch about 1MB of blocks at a time
+    size_t batch = std::max((size_t) 1, (size_t) (1 << 20) / block_size);
+    off_t* offs = new off_t[batch];
+    size_t prefetched = nblocks;    // blocks from here up are prefetched
 
     // Copy file data
-    while (nblocks != 0) {
-        // Choose block to read
-        size_t index = random() % nblocks;
-        size_t pos = blockpos[index] * block_size;
-        blockpos[index] = blockpos[nblocks - 1];
-        --nblocks;
+    for (size_t i = nblocks; i != 0; --i) {
+        // Stay one batch ahead of the copy
+        while (args.prefetch && prefetched != 0
+               && prefetched + batch >= i) {
+            size_t n = std::min(batch, prefetched);
+            for (size_t j = 0; j != n; ++j) {
+                offs[j] = blockpos[prefetched - 1 - j] * block_size;
+            }
+            io61_prefetch(inf, offs, n, block_size);
+            prefetched -= n;
+        }
 
-        // Transfer that block
+        // Transfer block
+        size_t pos = blockpos[i - 1] * block_size;
         io61_seek(inf, pos);
         ssize_t amount = io61_read(inf, buf, block_size);
         if (amount <= 0) {
@@ -75,4 +99,5 @@ int main(int argc, char* argv[]) {
     io61_profile_end();
     delete[] buf;
     delete[] blockpos;
+    delete[] offs;
 }
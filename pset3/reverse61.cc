@@ -1,16 +1,21 @@
 #include "io61.hh"
+#include <algorithm>
 
-// Usage: ./reverse61 [-s SIZE] [-o OUTFILE] [FILE]
+// Usage: ./reverse61 [-s SIZE] [-b BLOCKSIZE] [-a] [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE one character at a time,
 //    reversing the order of characters in the input.
+//    With `-b`, reads BLOCKSIZE characters at a time backwards from the
+//    end of FILE with `io61_read_backwards` instead.
+//    With `-a`, reads FILE ahead asynchronously (IO61_ASYNC).
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args(argc, argv, "s:o:i:");
+    io61_arguments args(argc, argv, "s:b:ao:i:");
 
     // Open files, measure file sizes
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file,
+                                     O_RDONLY | (args.async ? IO61_ASYNC : 0));
     io61_file* outf = io61_open_check(args.output_file,
                                       O_WRONLY | O_CREAT | O_TRUNC);
 
@@ -26,6 +31,21 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
+    if (args.block_size) {
+        char* buf = new char[args.block_size];
+        io61_seek(inf, args.input_size);
+        while (args.input_size != 0) {
+            ssize_t amount = io61_read_backwards(
+                inf, buf, std::min(args.block_size, args.input_size));
+            if (amount <= 0) {
+                break;
+            }
+            io61_write(outf, buf, amount);
+            args.input_size -= amount;
+        }
+        delete[] buf;
+    }
+
     while (args.input_size != 0) {
         --args.input_size;
         io61_seek(inf, args.input_size);
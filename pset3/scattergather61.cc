@@ -1,7 +1,8 @@
 #include "io61.hh"
 #include <vector>
 
-// Usage: ./scattergather61 [-b BLOCKSIZE] [-i IFILE | -o OFILE]...
+// Usage: ./scattergather61 [-b BLOCKSIZE] [-l | -v COUNT]
+//                          [-i IFILE | -o OFILE]...
 //    Copies the input IFILEs to the output OFILEs, alternating
 //    with every block. (I.e., read from IFILE1 and write to OFILE1,
 //    then read from IFILE2 and write to OFILE2, etc. There may be
@@ -9,22 +10,14 @@
 //    "scatter/gather" I/O pattern: input is "gathered" from many
 //    input files and "scattered" to many output files.
 //    Default BLOCKSIZE is 1.
+//
+//    With `-v COUNT`, each step moves COUNT blocks instead of one: they
+//    are read into COUNT separate buffers with `io61_readv`, then
+//    written to the same OFILE with `io61_writev`.
 
 ssize_t read_line(io61_file* f, char* buf, size_t sz, bool lines) {
     if (lines) {
-        size_t i = 0;
-        while (i != sz) {
-            int ch = io61_readc(f);
-            if (ch == EOF) {
-                break;
-            }
-            buf[i] = ch;
-            ++i;
-            if (ch == '\n') {
-                break;
-            }
-        }
-        return i;
+        return io61_readline(f, buf, sz);
     } else {
         return io61_read(f, buf, sz);
     }
@@ -33,11 +26,21 @@ ssize_t read_line(io61_file* f, char* buf, size_t sz, bool lines) {
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args(argc, argv, "b:i:o:l##");
+    io61_arguments args(argc, argv, "b:i:o:lv:##");
     size_t block_size = args.block_size ? args.block_size : 1;
+    if (args.lines && args.iovcnt) {
+        args.usage();
+        exit(1);
+    }
 
-    // Allocate buffer, open files
-    char* buf = new char[block_size];
+    // Allocate buffers, open files
+    size_t nbufs = args.iovcnt ? args.iovcnt : 1;
+    std::vector<struct iovec> iov(nbufs), wiov(nbufs);
+    for (auto& v : iov) {
+        v.iov_base = new char[block_size];
+        v.iov_len = block_size;
+    }
+    char* buf = (char*) iov[0].iov_base;
 
     io61_profile_begin();
     std::vector<io61_file*> infs, outfs;
@@ -54,11 +57,26 @@ int main(int argc, char* argv[]) {
     size_t ini = -1, outi = 0;
     while (!infs.empty()) {
         ini = (ini + 1) % infs.size();
-        ssize_t amount = read_line(infs[ini], buf, block_size, args.lines);
+        ssize_t amount;
+        if (args.iovcnt) {
+            amount = io61_readv(infs[ini], iov.data(), nbufs);
+        } else {
+            amount = read_line(infs[ini], buf, block_size, args.lines);
+        }
         if (amount <= 0) {
             io61_close(infs[ini]);
             infs.erase(infs.begin() + ini);
             --ini;
+        } else if (args.iovcnt) {
+            // write the filled buffers; the last may be partly filled
+            size_t n = 0;
+            for (size_t left = amount; left != 0; ++n) {
+                wiov[n].iov_base = iov[n].iov_base;
+                wiov[n].iov_len = std::min(left, block_size);
+                left -= wiov[n].iov_len;
+            }
+            io61_writev(outfs[outi], wiov.data(), n);
+            outi = (outi + 1) % outfs.size();
         } else {
             io61_write(outfs[outi], buf, amount);
             outi = (outi + 1) % outfs.size();
@@ -69,5 +87,7 @@ int main(int argc, char* argv[]) {
         io61_close(f);
     }
     io61_profile_end();
-    delete[] buf;
+    for (auto& v : iov) {
+        delete[] (char*) v.iov_base;
+    }
 }
@@ -1,8 +1,12 @@
 #include "io61.hh"
+#include "lz61.hh"
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <stdint.h>
 #include <errno.h>
+#include <thread>
 
 // slow-io61.c
 //    This is a copy of the handout version of io61.c.
@@ -13,6 +17,15 @@
 
 struct io61_file {
     int fd;
+    // io61_peek/io61_reserve buffer
+    char bbuf[BUFSIZ];
+    size_t bpos = 0;
+    size_t blen = 0;
+    bool shared = false;        // IO61_SHARED: no io61_reserve
+    // IO61_LZ61 codec thread, at the other end of a socket
+    std::thread zthread;
+    int zfd = -1;               // closed once the thread finishes
+    int zstatus = 0;
 };
 
 
@@ -24,8 +37,24 @@ struct io61_file {
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
+    f->shared = mode & IO61_SHARED;
+    if (mode & IO61_LZ61) {
+        // Data passes through a socket to a thread that runs the codec.
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+            delete f;
+            return nullptr;
+        }
+        bool compress = (mode & O_ACCMODE) != O_RDONLY;
+        int in = compress ? sv[0] : fd, out = compress ? fd : sv[0];
+        f->zthread = std::thread([f, in, out, compress] {
+            int r = lz61_pump(in, out, compress);
+            f->zstatus = compress ? r : 0; // readers just see end of file
+        });
+        f->zfd = in;
+        fd = sv[1];
+    }
     f->fd = fd;
-    (void) mode;
     return f;
 }
 
@@ -36,6 +65,11 @@ io61_file* io61_fdopen(int fd, int mode) {
 int io61_close(io61_file* f) {
     io61_flush(f);
     int r = close(f->fd);
+    if (f->zthread.joinable()) {
+        f->zthread.join();
+        close(f->zfd);
+        r = f->zstatus < 0 ? -1 : r;
+    }
     delete f;
     return r;
 }
@@ -81,6 +115,131 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 }
 
 
+// io61_read_backwards(f, buf, sz)
+//    Read up to `sz` characters that precede `f`'s file position, in
+//    decreasing file order: `buf[0]` gets the character just before the
+//    position. Moves the file position back past the characters read.
+//    Returns the number of characters read, which is short only at the
+//    start of the file, or -1 if an error occurred before any characters
+//    were read.
+
+ssize_t io61_read_backwards(io61_file* f, char* buf, size_t sz) {
+    off_t pos = lseek(f->fd, 0, SEEK_CUR);
+    if (pos == (off_t) -1) {
+        return -1;
+    }
+    size_t nread = 0;
+    while (nread != sz && pos != 0) {
+        if (lseek(f->fd, pos - 1, SEEK_SET) == (off_t) -1
+            || read(f->fd, &buf[nread], 1) != 1) {
+            break;
+        }
+        --pos;
+        ++nread;
+    }
+    lseek(f->fd, pos, SEEK_SET);
+    return nread;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Read characters from `f` into `buf` up to and including the next
+//    newline, stopping early after `sz` characters or at end of file.
+//    Returns the number of characters read, 0 at end of file, or -1 if
+//    an error occurred before any characters were read.
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        int ch = io61_readc(f);
+        if (ch == EOF) {
+            break;
+        }
+        buf[nread] = ch;
+        ++nread;
+        if (ch == '\n') {
+            break;
+        }
+    }
+    return nread;
+}
+
+
+// io61_pread(f, buf, sz, off)
+//    Read up to `sz` characters at file offset `off` into `buf` without
+//    using or changing `f`'s file position. Returns the number of
+//    characters read, or -1 on error.
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    size_t n = 0;
+    while (n != sz) {
+        ssize_t r = pread(f->fd, buf + n, sz - n, off + n);
+        if (r > 0) {
+            n += r;
+        } else if (r == 0) {
+            break;
+        } else if (errno != EINTR) {
+            return n ? (ssize_t) n : -1;
+        }
+    }
+    return n;
+}
+
+
+// io61_prefetch(f, offs, n, blocksize)
+//    Tell `f` that the caller will soon read the `n` blocks of
+//    `blocksize` bytes starting at offsets `offs[0..n)`. This version
+//    passes each block to the kernel as a readahead hint. Returns 0 on
+//    success and -1 on error.
+
+int io61_prefetch(io61_file* f, const off_t* offs, size_t n,
+                  size_t blocksize) {
+    for (size_t i = 0; i != n; ++i) {
+        int r = posix_fadvise(f->fd, offs[i], blocksize, POSIX_FADV_WILLNEED);
+        if (r != 0) {
+            errno = r;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// io61_peek(f, ptr, len)
+//    Expose the data at `f`'s file position: sets `*ptr` to the data
+//    and `*len` to its size, which is 0 at end of file. This version
+//    reads the data into a private buffer, so don't mix io61_peek with
+//    other reads until everything it exposed has been consumed.
+//    Returns 0 on success and -1 on error.
+
+int io61_peek(io61_file* f, const char** ptr, size_t* len) {
+    if (f->bpos == f->blen) {
+        ssize_t r = io61_read(f, f->bbuf, sizeof(f->bbuf));
+        if (r < 0) {
+            return -1;
+        }
+        f->bpos = 0;
+        f->blen = r;
+    }
+    *ptr = f->bbuf + f->bpos;
+    *len = f->blen - f->bpos;
+    return 0;
+}
+
+
+// io61_consume(f, n)
+//    Advance `f`'s file position past `n` bytes returned by io61_peek.
+//    Returns 0 on success and -1 if fewer than `n` bytes were exposed.
+
+int io61_consume(io61_file* f, size_t n) {
+    if (f->bpos + n > f->blen) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->bpos += n;
+    return 0;
+}
+
+
 // io61_writec(f)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
@@ -116,6 +275,87 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
     }
 }
 
+// io61_readv(f, iov, iovcnt)
+//    Read into the `iovcnt` buffers described by `iov`, in order.
+//    Returns the number of bytes read, or -1 if an error occurred before
+//    any bytes were read.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_read(f, (char*) iov[i].iov_base, iov[i].iov_len);
+        if (n < 0) {
+            return nread ? (ssize_t) nread : -1;
+        }
+        nread += n;
+        if ((size_t) n != iov[i].iov_len) {
+            break;
+        }
+    }
+    return nread;
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Write the `iovcnt` buffers described by `iov`, in order. Returns
+//    the number of bytes written, or -1 if an error occurred before any
+//    bytes were written.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_write(f, (const char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (n < 0) {
+            return nwritten ? (ssize_t) nwritten : -1;
+        }
+        nwritten += n;
+        if ((size_t) n != iov[i].iov_len) {
+            break;
+        }
+    }
+    return nwritten;
+}
+
+
+// io61_reserve(f, ptr, len)
+//    Expose space for writing to `f`: sets `*ptr` to it and `*len` to
+//    its size. Data placed there is written by io61_commit. Returns 0,
+//    or -1 for an IO61_SHARED file, whose writers can't share `bbuf`.
+
+int io61_reserve(io61_file* f, char** ptr, size_t* len) {
+    if (f->shared) {
+        errno = EINVAL;
+        return -1;
+    }
+    *ptr = f->bbuf;
+    *len = sizeof(f->bbuf);
+    return 0;
+}
+
+
+// io61_commit(f, n)
+//    Write the first `n` bytes of the space returned by io61_reserve.
+//    Returns 0 on success and -1 on error.
+
+int io61_commit(io61_file* f, size_t n) {
+    if (f->shared || n > sizeof(f->bbuf)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return io61_write(f, f->bbuf, n) == (ssize_t) n ? 0 : -1;
+}
+
+
+// io61_pair(inf, outf)
+//    Pair a read-only pipe or socket with a write-only one. This version
+//    has no paired mode, so callers must flush before reading.
+
+int io61_pair(io61_file* inf, io61_file* outf) {
+    (void) inf, (void) outf;
+    return 0;
+}
+
 
 // io61_flush(f)
 //    Forces a write of all buffered data written to `f`.
@@ -142,6 +382,61 @@ int io61_seek(io61_file* f, off_t pos) {
 }
 
 
+// io61_setsize(f, size)
+//    Declare that write-only file `f` will be `size` bytes long, and
+//    make it that long now. Returns 0 on success and -1 on error.
+
+int io61_setsize(io61_file* f, off_t size) {
+    return ftruncate(f->fd, size);
+}
+
+
+// io61_copy(out, in, n)
+//    Copy up to `n` bytes from `in` to `out`, stopping early at end of
+//    file. Returns the number of bytes copied, or -1 if an error
+//    occurred before any were.
+
+ssize_t io61_copy(io61_file* out, io61_file* in, size_t n) {
+    size_t ncopied = 0;
+    while (ncopied != n) {
+        int ch = io61_readc(in);
+        if (ch == EOF || io61_writec(out, ch) == -1) {
+            break;
+        }
+        ++ncopied;
+    }
+    return ncopied;
+}
+
+
+// io61_copyall(outs, ins, n)
+//    Copy each input `ins[i]` to output `outs[i]` until end of file,
+//    for `i` in `[0, n)`, overlapping the copies. This version
+//    copies them one at a time. Returns 0 on success and -1 if any copy
+//    failed.
+
+int io61_copyall(io61_file** outs, io61_file** ins, size_t n) {
+    int status = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (io61_copy(outs[i], ins[i], SIZE_MAX) < 0
+            || io61_flush(outs[i]) < 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+
+// io61_zopen(filename, mode)
+//    Like io61_open_check, but the file holds an lz61 compressed stream:
+//    data written to the returned file is compressed, and data read from
+//    it is decompressed.
+
+io61_file* io61_zopen(const char* filename, int mode) {
+    return io61_open_check(filename, mode | IO61_LZ61);
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -153,7 +448,7 @@ int io61_seek(io61_file* f, off_t pos) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename) {
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_FLAGS, 0666);
     } else if ((mode & O_ACCMODE) == O_RDONLY) {
         fd = STDIN_FILENO;
     } else {
@@ -163,7 +458,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_FLAGS));
 }
 
 
@@ -0,0 +1,177 @@
+#include "io61.hh"
+#include <stdint.h>
+#include <inttypes.h>
+#include <thread>
+
+// Usage: ./sum61 [-j THREADS] [FILE...]
+//    Prints a 64-bit hash of each FILE (default standard input), in
+//    the format of md5sum. The file is split into 1MB chunks that
+//    THREADS threads read with io61_pread and hash at once; the chunk
+//    hashes are then hashed together, so the result doesn't depend on
+//    THREADS. Default THREADS is the number of CPUs.
+//
+//    sum61 checks test outputs, so it's linked with the stdio version
+//    of io61, which a broken io61.cc can't affect.
+
+#define SUM61_CHUNKSIZE (1 << 20)
+
+
+// xxh64(buf, sz, seed)
+//    Return the XXH64 hash of `buf[0..sz)`. The main loop keeps four
+//    independent lanes, so the CPU can work on all of them at once.
+
+static const uint64_t xxh_prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t xxh_prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return x;                   // assumes a little-endian CPU
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * xxh_prime2;
+    return rotl64(acc, 31) * xxh_prime1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * xxh_prime1 + xxh_prime4;
+}
+
+static uint64_t xxh64(const unsigned char* p, size_t sz, uint64_t seed) {
+    const unsigned char* end = p + sz;
+    uint64_t h;
+    if (sz >= 32) {
+        uint64_t v1 = seed + xxh_prime1 + xxh_prime2;
+        uint64_t v2 = seed + xxh_prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - xxh_prime1;
+        for (; end - p >= 32; p += 32) {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + xxh_prime5;
+    }
+    h += sz;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * xxh_prime1 + xxh_prime4;
+    }
+    if (end - p >= 4) {
+        uint32_t x;
+        memcpy(&x, p, 4);
+        h ^= x * xxh_prime1;
+        h = rotl64(h, 23) * xxh_prime2 + xxh_prime3;
+        p += 4;
+    }
+    for (; p != end; ++p) {
+        h ^= *p * xxh_prime5;
+        h = rotl64(h, 11) * xxh_prime1;
+    }
+
+    h ^= h >> 33;
+    h *= xxh_prime2;
+    h ^= h >> 29;
+    h *= xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+// hash_chunks(f, size, hashes, t, nthreads)
+//    Thread `t`'s share of the work: hash chunks `t`, `t + nthreads`,
+//    ... of the `size`-byte file `f` into `hashes`.
+
+static void hash_chunks(io61_file* f, off_t size, uint64_t* hashes,
+                        size_t t, size_t nthreads) {
+    unsigned char* buf = new unsigned char[SUM61_CHUNKSIZE];
+    for (size_t i = t; (off_t) i * SUM61_CHUNKSIZE < size; i += nthreads) {
+        ssize_t n = io61_pread(f, (char*) buf, SUM61_CHUNKSIZE,
+                               (off_t) i * SUM61_CHUNKSIZE);
+        if (n < 0) {
+            perror("sum61: read");
+            exit(1);
+        }
+        hashes[i] = xxh64(buf, n, 0);
+    }
+    delete[] buf;
+}
+
+
+// sum_file(f, nthreads)
+//    Return the hash of `f`: XXH64 of its chunks' hashes, seeded with
+//    its size. Files without a size, such as pipes, are read in order.
+
+static uint64_t sum_file(io61_file* f, size_t nthreads) {
+    std::vector<uint64_t> hashes;
+    off_t size = io61_filesize(f);
+    if (size >= 0) {
+        hashes.resize((size + SUM61_CHUNKSIZE - 1) / SUM61_CHUNKSIZE);
+        nthreads = std::min(nthreads, std::max(hashes.size(), (size_t) 1));
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < nthreads; ++t) {
+            threads.emplace_back(hash_chunks, f, size, hashes.data(),
+                                 t, nthreads);
+        }
+        hash_chunks(f, size, hashes.data(), 0, nthreads);
+        for (auto& th : threads) {
+            th.join();
+        }
+    } else {
+        unsigned char* buf = new unsigned char[SUM61_CHUNKSIZE];
+        size = 0;
+        while (true) {
+            // fill whole chunks, so the hash matches the parallel one
+            ssize_t n = 0, r = 1;
+            while (n != SUM61_CHUNKSIZE
+                   && (r = io61_read(f, (char*) buf + n, SUM61_CHUNKSIZE - n)) > 0) {
+                n += r;
+            }
+            if (r < 0) {
+                perror("sum61: read");
+                exit(1);
+            } else if (n == 0) {
+                break;
+            }
+            hashes.push_back(xxh64(buf, n, 0));
+            size += n;
+        }
+        delete[] buf;
+    }
+    return xxh64((const unsigned char*) hashes.data(),
+                 hashes.size() * sizeof(uint64_t), size);
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "j:i:#");
+    size_t nthreads = args.nthreads;
+    if (nthreads == 0) {
+        nthreads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+
+    for (auto filename : args.input_files) {
+        io61_file* f = io61_open_check(filename, O_RDONLY);
+        printf("%016" PRIx64 "  %s\n", sum_file(f, nthreads),
+               filename ? filename : "-");
+        io61_close(f);
+    }
+}
@@ -0,0 +1,49 @@
+#include "io61.hh"
+#include <algorithm>
+
+// Usage: ./zcat61 [-s SIZE] [-b BLOCKSIZE] [-u] [-o OUTFILE] [FILE]
+//    Compresses the input FILE into OUTFILE with `io61_zopen`, one
+//    character at a time, or in blocks of BLOCKSIZE with `-b`.
+//    With `-u`, decompresses FILE instead.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "s:b:uo:i:");
+    char* buf = new char[args.block_size ? args.block_size : 1];
+
+    io61_profile_begin();
+    io61_file* inf;
+    io61_file* outf;
+    if (args.uncompress) {
+        inf = io61_zopen(args.input_file, O_RDONLY);
+        outf = io61_open_check(args.output_file,
+                               O_WRONLY | O_CREAT | O_TRUNC);
+    } else {
+        inf = io61_open_check(args.input_file, O_RDONLY);
+        outf = io61_zopen(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
+    }
+
+    while (args.input_size > 0) {
+        if (args.block_size) {
+            ssize_t amount = io61_read(inf, buf,
+                                       std::min(args.block_size, args.input_size));
+            if (amount <= 0) {
+                break;
+            }
+            io61_write(outf, buf, amount);
+            args.input_size -= amount;
+        } else {
+            int ch = io61_readc(inf);
+            if (ch == EOF) {
+                break;
+            }
+            io61_writec(outf, ch);
+            --args.input_size;
+        }
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+}